@@ -55,5 +55,19 @@ let package = Package(
       name: "UnarchiveKitTests",
       dependencies: ["UnarchiveKit"]
     ),
+    .target(
+      name: "libtarChecks",
+      dependencies: ["libtar"],
+      path: "Tests/libtarChecks"
+    ),
+    .testTarget(
+      name: "libtarTests",
+      dependencies: ["libtarChecks"]
+    ),
+    .executableTarget(
+      name: "bench_read",
+      dependencies: ["libtar"],
+      path: "Tests/libtar"
+    ),
   ]
 )
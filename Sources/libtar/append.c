@@ -28,6 +28,7 @@
 #endif
 
 
+/* no longer used; the type is only here for tar_dev_free() */
 struct tar_dev
 {
 	dev_t td_dev;
@@ -35,20 +36,267 @@ struct tar_dev
 };
 typedef struct tar_dev tar_dev_t;
 
+/*
+** a file with more than one link, in the handle's (dev, ino) table;
+** both the entry and the name live in the arena
+*/
 struct tar_ino
 {
+	dev_t ti_dev;
 	ino_t ti_ino;
-	char ti_name[MAXPATHLEN];
+	char *ti_name;
 };
 typedef struct tar_ino tar_ino_t;
 
 
-/* free memory associated with a tar_dev_t */
+/* this is obsolete - it's here for backwards-compatibility only */
 void
 tar_dev_free(tar_dev_t *tdp)
 {
-	libtar_hash_free(tdp->td_h, free);
-	free(tdp);
+	(void)tdp;
+}
+
+
+/* hashing function for the (dev, ino) table */
+unsigned int
+tar_ino_hash(tar_ino_t *ti, unsigned int numbuckets)
+{
+	uint64_t v;
+
+	v = (uint64_t)ti->ti_ino * 0x9e3779b97f4a7c15ULL
+	    ^ (uint64_t)ti->ti_dev;
+	return (unsigned int)((v ^ (v >> 32)) % numbuckets);
+}
+
+
+/* matching function for the (dev, ino) table */
+int
+tar_ino_match(tar_ino_t *key, tar_ino_t *ti)
+{
+	return (key->ti_ino == ti->ti_ino && key->ti_dev == ti->ti_dev);
+}
+
+
+/*
+** find the data runs of an open regular file with SEEK_DATA/SEEK_HOLE
+** returns 1 if the file has holes (and sets up the sparse map), 0 if not
+** or if the file system can't tell, or -1 (and sets errno) on error
+*/
+static int
+tar_sparse_scan(TAR *t, int fd, off_t size)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	off_t data, hole = 0, total = 0;
+
+	while (hole < size)
+	{
+		data = lseek(fd, hole, SEEK_DATA);
+		if (data == -1 && errno == ENXIO)
+			break;		/* only a hole is left */
+		if (data == -1)
+			return (errno == EINVAL ? 0 : -1);
+		if (data >= size)
+			break;
+
+		hole = lseek(fd, data, SEEK_HOLE);
+		if (hole == -1)
+			return -1;
+		if (hole > size)
+			hole = size;
+		if (th_sparse_add(t, data, hole - data) == -1)
+			return -1;
+		total += hole - data;
+	}
+
+	if (total == size)
+	{
+		t->th_buf.sparse = NULL;
+		t->th_buf.nsparse = 0;
+		return 0;
+	}
+
+	/* like GNU tar, end the map with an empty run if the file ends in a hole */
+	if (hole < size && th_sparse_add(t, size, 0) == -1)
+		return -1;
+	t->th_buf.realsize = size;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+/* output for tar_append_sparse(), packed into whole blocks */
+struct sparse_out
+{
+	TAR *t;
+	char block[T_BLOCKSIZE];
+	size_t len;
+};
+
+
+static int
+sparse_put(struct sparse_out *o, const char *data, size_t len)
+{
+	size_t n;
+	int i;
+
+	while (len > 0)
+	{
+		n = T_BLOCKSIZE - o->len;
+		if (n > len)
+			n = len;
+		memcpy(o->block + o->len, data, n);
+		o->len += n;
+		data += n;
+		len -= n;
+
+		if (o->len == T_BLOCKSIZE)
+		{
+			i = tar_block_write(o->t, o->block);
+			if (i != T_BLOCKSIZE)
+			{
+				if (i != -1)
+					errno = EINVAL;
+				return -1;
+			}
+			o->len = 0;
+		}
+	}
+
+	return 0;
+}
+
+
+/* zero-fill the last partial block */
+static int
+sparse_pad(struct sparse_out *o)
+{
+	char zero[T_BLOCKSIZE];
+
+	if (o->len == 0)
+		return 0;
+	memset(zero, 0, T_BLOCKSIZE);
+	return sparse_put(o, zero, T_BLOCKSIZE - o->len);
+}
+
+
+/*
+** append a regular file that has holes as a PAX format 1.0 sparse file:
+** an extended header with the real name and size, then a header whose
+** contents are the sparse map followed by only the data runs
+** returns 0 on success, 1 if the file has no holes after all, or -1 (and
+** sets errno) on error
+*/
+static int
+tar_append_sparse(TAR *t, const char *realname, const char *savename,
+		  off_t size)
+{
+	struct sparse_out o;
+	struct tar_sparse *sp;
+	char buf[T_BLOCKSIZE * 32];
+	char num[32], dir[MAXPATHLEN], base[MAXPATHLEN];
+	off_t mapsize, total = 0, left, pos;
+	size_t len = 0;
+	ssize_t k;
+	int fd, i, options, rv = -1;
+
+	fd = open(realname, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	i = tar_sparse_scan(t, fd, size);
+	if (i != 1)
+	{
+		close(fd);
+		return (i == 0 ? 1 : -1);
+	}
+	sp = t->th_buf.sparse;
+
+	/* the map is stored as decimal lines, padded to a whole block */
+	mapsize = snprintf(NULL, 0, "%d\n", t->th_buf.nsparse);
+	for (i = 0; i < t->th_buf.nsparse; i++)
+	{
+		mapsize += snprintf(NULL, 0, "%lld\n%lld\n",
+				    (long long)sp[i].offset,
+				    (long long)sp[i].numbytes);
+		total += sp[i].numbytes;
+	}
+	mapsize = (mapsize + T_BLOCKSIZE - 1) & ~((off_t)T_BLOCKSIZE - 1);
+
+	/* the real name goes in the extended header */
+	snprintf(num, sizeof(num), "%lld", (long long)size);
+	if (th_pax_record(t, &len, "GNU.sparse.major", "1") == -1
+	    || th_pax_record(t, &len, "GNU.sparse.minor", "0") == -1
+	    || th_pax_record(t, &len, "GNU.sparse.name", savename) == -1
+	    || th_pax_record(t, &len, "GNU.sparse.realsize", num) == -1)
+		goto out;
+
+	/*
+	** readers that don't know the format extract a placeholder, which
+	** only needs to fit the name field; GNU tar ignores PAX sparse
+	** headers unless they have POSIX magic, even in a GNU archive
+	*/
+	options = t->options;
+	t->options &= ~TAR_GNU;
+	strlcpy(dir, savename, sizeof(dir));
+	strlcpy(base, savename, sizeof(base));
+	snprintf(buf, T_NAMELEN, "%s/GNUSparseFile.0/%s",
+		 dirname(dir), basename(base));
+	th_set_path(t, buf);
+	th_set_size(t, mapsize + total);
+	t->th_buf.pax_path = (char *)savename;
+	th_decode(t);
+
+	if (t->options & TAR_VERBOSE)
+		th_print_long_ls(t);
+
+	i = (th_write_pax(t, len) == -1 || th_write(t) == -1);
+	t->options = options;
+	if (i)
+		goto out;
+
+	o.t = t;
+	o.len = 0;
+	len = snprintf(num, sizeof(num), "%d\n", t->th_buf.nsparse);
+	if (sparse_put(&o, num, len) == -1)
+		goto out;
+	for (i = 0; i < t->th_buf.nsparse; i++)
+	{
+		len = snprintf(num, sizeof(num), "%lld\n%lld\n",
+			       (long long)sp[i].offset,
+			       (long long)sp[i].numbytes);
+		if (sparse_put(&o, num, len) == -1)
+			goto out;
+	}
+	if (sparse_pad(&o) == -1)
+		goto out;
+
+	/* the data runs follow each other without padding */
+	for (i = 0; i < t->th_buf.nsparse; i++)
+	{
+		pos = sp[i].offset;
+		for (left = sp[i].numbytes; left > 0; left -= k, pos += k)
+		{
+			k = pread(fd, buf, (left > (off_t)sizeof(buf)
+					    ? sizeof(buf) : (size_t)left), pos);
+			if (k <= 0)
+			{
+				/* the file shrank while we were reading it */
+				if (k == 0)
+					errno = EINVAL;
+				goto out;
+			}
+			if (sparse_put(&o, buf, k) == -1)
+				goto out;
+		}
+	}
+	if (sparse_pad(&o) == -1)
+		goto out;
+
+	rv = 0;
+ out:
+	close(fd);
+	return rv;
 }
 
 
@@ -59,8 +307,7 @@ tar_append_file(TAR *t, const char *realname, const char *savename)
 	struct stat s;
 	int i;
 	libtar_hashptr_t hp;
-	tar_dev_t *td = NULL;
-	tar_ino_t *ti = NULL;
+	tar_ino_t key, *ti;
 	char path[MAXPATHLEN];
 
 #ifdef DEBUG
@@ -94,54 +341,44 @@ tar_append_file(TAR *t, const char *realname, const char *savename)
 #ifdef DEBUG
 	puts("    tar_append_file(): checking inode cache for hardlink...");
 #endif
-	libtar_hashptr_reset(&hp);
-	if (libtar_hash_getkey(t->h, &hp, &(s.st_dev),
-			       (libtar_matchfunc_t)dev_match) != 0)
-		td = (tar_dev_t *)libtar_hashptr_data(&hp);
-	else
+	/* only a file with other links can turn up again */
+	if (s.st_nlink > 1 && !S_ISDIR(s.st_mode))
 	{
+		key.ti_dev = s.st_dev;
+		key.ti_ino = s.st_ino;
+		libtar_hashptr_reset(&hp);
+		if (libtar_hash_getkey(t->h, &hp, &key,
+				       (libtar_matchfunc_t)tar_ino_match) != 0)
+		{
+			ti = (tar_ino_t *)libtar_hashptr_data(&hp);
 #ifdef DEBUG
-		printf("+++ adding hash for device (0x%lx, 0x%lx)...\n",
-		       major(s.st_dev), minor(s.st_dev));
-#endif
-		td = (tar_dev_t *)calloc(1, sizeof(tar_dev_t));
-		td->td_dev = s.st_dev;
-		td->td_h = libtar_hash_new(256, (libtar_hashfunc_t)ino_hash);
-		if (td->td_h == NULL)
-			return -1;
-		if (libtar_hash_add(t->h, td) == -1)
-			return -1;
-	}
-	libtar_hashptr_reset(&hp);
-	if (libtar_hash_getkey(td->td_h, &hp, &(s.st_ino),
-			       (libtar_matchfunc_t)ino_match) != 0)
-	{
-		ti = (tar_ino_t *)libtar_hashptr_data(&hp);
-#ifdef DEBUG
-		printf("    tar_append_file(): encoding hard link \"%s\" "
-		       "to \"%s\"...\n", realname, ti->ti_name);
+			printf("    tar_append_file(): encoding hard link \"%s\" "
+			       "to \"%s\"...\n", realname, ti->ti_name);
 #endif
-		t->th_buf.typeflag = LNKTYPE;
-		th_set_link(t, ti->ti_name);
-	}
-	else
-	{
+			t->th_buf.typeflag = LNKTYPE;
+			th_set_link(t, ti->ti_name);
+		}
+		else
+		{
 #ifdef DEBUG
-		printf("+++ adding entry: device (0x%lx,0x%lx), inode %ld "
-		       "(\"%s\")...\n", major(s.st_dev), minor(s.st_dev),
-		       s.st_ino, realname);
+			printf("+++ adding entry: device (0x%lx,0x%lx), "
+			       "inode %ld (\"%s\")...\n", major(s.st_dev),
+			       minor(s.st_dev), s.st_ino, realname);
 #endif
-		ti = (tar_ino_t *)calloc(1, sizeof(tar_ino_t));
-		if (ti == NULL)
-			return -1;
-		ti->ti_ino = s.st_ino;
-		snprintf(ti->ti_name, sizeof(ti->ti_name), "%s",
-			 savename ? savename : realname);
-		libtar_hash_add(td->td_h, ti);
+			ti = (tar_ino_t *)tar_arena_alloc(t, sizeof(tar_ino_t));
+			if (ti == NULL)
+				return -1;
+			*ti = key;
+			ti->ti_name = tar_arena_strdup(t, (savename ? savename
+							   : realname));
+			if (ti->ti_name == NULL
+			    || libtar_hash_add(t->h, ti) == -1)
+				return -1;
+		}
 	}
 
 	/* check if it's a symlink */
-	if (TH_ISSYM(t))
+	if (S_ISLNK(s.st_mode))
 	{
 		i = readlink(realname, path, sizeof(path));
 		if (i == -1)
@@ -155,6 +392,18 @@ tar_append_file(TAR *t, const char *realname, const char *savename)
 #endif
 		th_set_link(t, path);
 	}
+	th_decode(t);
+
+	/* holes only take up archive space when asked for */
+	if ((t->options & TAR_SPARSE) && t->th_buf.typeflag == REGTYPE
+	    && (off_t)s.st_blocks * 512 < s.st_size)
+	{
+		i = tar_append_sparse(t, realname,
+				      (savename ? savename : realname),
+				      s.st_size);
+		if (i != 1)
+			return i;
+	}
 
 	/* print file info */
 	if (t->options & TAR_VERBOSE)
@@ -202,7 +451,7 @@ tar_append_eof(TAR *t)
 		}
 	}
 
-	return 0;
+	return tar_flush(t);
 }
 
 
@@ -210,10 +459,11 @@ tar_append_eof(TAR *t)
 int
 tar_append_regfile(TAR *t, const char *realname)
 {
-	char block[T_BLOCKSIZE];
-	int filefd;
-	int i, j;
-	size_t size;
+	char *ptr;
+	int filefd, err;
+	off_t size;
+	ssize_t k, n;
+	size_t pad;
 
 	filefd = open(realname, O_RDONLY);
 	if (filefd == -1)
@@ -224,33 +474,44 @@ tar_append_regfile(TAR *t, const char *realname)
 		return -1;
 	}
 
-	size = th_get_size(t);
-	for (i = size; i > T_BLOCKSIZE; i -= T_BLOCKSIZE)
+	/* read straight into the output buffer, as much as fits each time */
+	for (size = th_hdr_size(t); size > 0; size -= k)
 	{
-		j = read(filefd, &block, T_BLOCKSIZE);
-		if (j != T_BLOCKSIZE)
+		n = tar_block_space(t, &ptr);
+		if (n == -1)
+			goto fail;
+		if ((off_t)n > size)
+			n = (ssize_t)size;
+		k = read(filefd, ptr, (size_t)n);
+		if (k <= 0)
 		{
-			if (j != -1)
+			/* the file shrank while we were reading it */
+			if (k == 0)
 				errno = EINVAL;
-			return -1;
+			goto fail;
 		}
-		if (tar_block_write(t, &block) == -1)
-			return -1;
+		t->wbuflen += k;
 	}
 
-	if (i > 0)
+	/* zero-fill the last partial block */
+	pad = (size_t)(th_hdr_size(t) % T_BLOCKSIZE);
+	if (pad > 0)
 	{
-		j = read(filefd, &block, i);
-		if (j == -1)
-			return -1;
-		memset(&(block[i]), 0, T_BLOCKSIZE - i);
-		if (tar_block_write(t, &block) == -1)
-			return -1;
+		if (tar_block_space(t, &ptr) == -1)
+			goto fail;
+		memset(ptr, 0, T_BLOCKSIZE - pad);
+		t->wbuflen += T_BLOCKSIZE - pad;
 	}
 
 	close(filefd);
 
 	return 0;
+
+ fail:
+	err = errno;
+	close(filefd);
+	errno = err;
+	return -1;
 }
 
 
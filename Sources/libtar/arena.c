@@ -0,0 +1,198 @@
+/*
+**  arena.c - libtar code to allocate per-archive bookkeeping
+**
+**  Names remembered for hardlinks and the inode tables built while
+**  appending live as long as the TAR handle, so they are carved out of
+**  large chunks with a bump pointer instead of being malloc'd one by
+**  one, and all released at once by tar_close().  The chunks come from
+**  the handle's allocator, which the caller may replace to budget or
+**  account for the memory.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+
+/* size of the chunks requests are carved out of */
+#define ARENA_CHUNKSIZE		(64 * 1024)
+
+/* alignment of every allocation */
+#define ARENA_ALIGN		(2 * sizeof(void *))
+
+#define ARENA_ROUND(n)	(((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+
+struct tar_arena_chunk
+{
+	struct tar_arena_chunk *next;
+	size_t size;		/* including this header */
+};
+
+struct tar_arena
+{
+	tar_allocator_t allocator;
+	struct tar_arena_chunk *chunks;
+	char *ptr;		/* free space in the newest chunk */
+	size_t left;
+	struct tar_arena_stats stats;
+};
+
+
+static void *
+arena_malloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	return malloc(size);
+}
+
+
+static void
+arena_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+
+static tar_allocator_t default_allocator = { arena_malloc, arena_free, NULL };
+
+
+static struct tar_arena *
+arena_get(TAR *t)
+{
+	if (t->arena == NULL)
+	{
+		t->arena = (struct tar_arena *)calloc(1,
+						sizeof(struct tar_arena));
+		if (t->arena == NULL)
+			return NULL;
+		t->arena->allocator = default_allocator;
+	}
+
+	return t->arena;
+}
+
+
+/* replace the allocator backing the handle's bookkeeping */
+int
+tar_set_allocator(TAR *t, const tar_allocator_t *allocator)
+{
+	struct tar_arena *a;
+
+	a = arena_get(t);
+	if (a == NULL)
+		return -1;
+
+	/* chunks must go back to the allocator they came from */
+	if (a->chunks != NULL)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	a->allocator = (allocator ? *allocator : default_allocator);
+	return 0;
+}
+
+
+/* report the memory used for the handle's bookkeeping */
+void
+tar_arena_stats(TAR *t, struct tar_arena_stats *stats)
+{
+	if (t->arena == NULL)
+		memset(stats, 0, sizeof(*stats));
+	else
+		*stats = t->arena->stats;
+}
+
+
+/* allocate size bytes that live until tar_close() */
+void *
+tar_arena_alloc(TAR *t, size_t size)
+{
+	struct tar_arena *a;
+	struct tar_arena_chunk *c;
+	size_t csize;
+	void *p;
+
+	a = arena_get(t);
+	if (a == NULL)
+		return NULL;
+
+	size = ARENA_ROUND(size);
+	if (size > a->left)
+	{
+		/* a big request gets a chunk of its own */
+		csize = ARENA_ROUND(sizeof(struct tar_arena_chunk)) + size;
+		if (csize < ARENA_CHUNKSIZE)
+			csize = ARENA_CHUNKSIZE;
+
+		c = (struct tar_arena_chunk *)(*(a->allocator.allocfunc))
+			(a->allocator.ctx, csize);
+		if (c == NULL)
+		{
+			errno = ENOMEM;
+			return NULL;
+		}
+		c->size = csize;
+		c->next = a->chunks;
+		a->chunks = c;
+		a->stats.nchunks++;
+		a->stats.reserved += csize;
+
+		/* the rest of the old chunk is lost; it's less than size */
+		a->ptr = (char *)c + ARENA_ROUND(sizeof(struct tar_arena_chunk));
+		a->left = csize - ARENA_ROUND(sizeof(struct tar_arena_chunk));
+	}
+
+	p = a->ptr;
+	a->ptr += size;
+	a->left -= size;
+	a->stats.nallocs++;
+	a->stats.used += size;
+
+	return p;
+}
+
+
+/* copy a string into the arena */
+char *
+tar_arena_strdup(TAR *t, const char *s)
+{
+	size_t n = strlen(s) + 1;
+	char *p;
+
+	p = (char *)tar_arena_alloc(t, n);
+	if (p != NULL)
+		memcpy(p, s, n);
+
+	return p;
+}
+
+
+/* release everything allocated with tar_arena_alloc() */
+void
+tar_arena_free(TAR *t)
+{
+	struct tar_arena *a = t->arena;
+	struct tar_arena_chunk *c;
+
+	if (a == NULL)
+		return;
+
+	while ((c = a->chunks) != NULL)
+	{
+		a->chunks = c->next;
+		(*(a->allocator.freefunc))(a->allocator.ctx, c, c->size);
+	}
+	free(a);
+	t->arena = NULL;
+}
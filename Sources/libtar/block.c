@@ -25,15 +25,433 @@
 
 
 /*
-** Parse PAX extended header data.
+** refill the read-ahead buffer, keeping any unconsumed bytes
+** returns:
+**	1			at least one whole block is buffered
+**	0			EOF (a partial block may remain)
+**	-1 (and sets errno)	error
+*/
+static int
+tar_block_fill(TAR *t)
+{
+	size_t left;
+	ssize_t i;
+
+	/* a mapped archive is buffered in full */
+	if (t->map != NULL)
+		return 0;
+
+	if (t->rbuf == NULL)
+	{
+		if (t->rbufsize < T_BLOCKSIZE)
+			t->rbufsize = T_BLOCKSIZE;
+		t->rbuf = (char *)malloc(t->rbufsize);
+		if (t->rbuf == NULL)
+			return -1;
+	}
+
+	left = t->rbuflen - t->rbufpos;
+	if (left > 0 && t->rbufpos > 0)
+		memmove(t->rbuf, t->rbuf + t->rbufpos, left);
+	t->rbufpos = 0;
+	t->rbuflen = left;
+
+	/*
+	** a single large read is usually enough; only loop when the
+	** descriptor hands out less than a block at a time (e.g. pipes)
+	*/
+	while (t->rbuflen < T_BLOCKSIZE)
+	{
+		i = (*(t->type->readfunc))(t->fd, t->rbuf + t->rbuflen,
+					   t->rbufsize - t->rbuflen);
+		if (i == -1)
+			return -1;
+		if (i == 0)
+			return 0;
+		t->rbuflen += i;
+	}
+
+#ifdef DEBUG
+	printf("    tar_block_fill(): %zu bytes buffered\n", t->rbuflen);
+#endif
+	return 1;
+}
+
+
+/* read a single block */
+int
+tar_block_read(TAR *t, void *buf)
+{
+	size_t left;
+
+	if (t->rbuflen - t->rbufpos < T_BLOCKSIZE
+	    && tar_block_fill(t) == -1)
+		return -1;
+
+	left = t->rbuflen - t->rbufpos;
+	if (left > T_BLOCKSIZE)
+		left = T_BLOCKSIZE;
+	memcpy(buf, t->rbuf + t->rbufpos, left);
+	t->rbufpos += left;
+	t->offset += left;
+
+	return left;
+}
+
+
+/* consume up to len bytes straight out of the read-ahead buffer */
+ssize_t
+tar_block_next(TAR *t, size_t len, char **ptr)
+{
+	size_t avail;
+
+	if (t->rbuflen - t->rbufpos < T_BLOCKSIZE)
+	{
+		switch (tar_block_fill(t))
+		{
+		case -1:
+			return -1;
+		case 0:
+			/* drop the partial block, just like tar_block_read() */
+			t->offset += t->rbuflen - t->rbufpos;
+			t->rbufpos = t->rbuflen;
+			return 0;
+		}
+	}
+
+	len = (len + T_BLOCKSIZE - 1) & ~((size_t)T_BLOCKSIZE - 1);
+	avail = (t->rbuflen - t->rbufpos) & ~((size_t)T_BLOCKSIZE - 1);
+	if (len > avail)
+		len = avail;
+
+	*ptr = t->rbuf + t->rbufpos;
+	t->rbufpos += len;
+	t->offset += len;
+
+	return len;
+}
+
+
+/* skip len bytes of archive data */
+int
+tar_block_skip(TAR *t, off_t len)
+{
+	size_t left;
+	off_t i;
+	ssize_t k;
+	char *buf;
+
+	/* whatever is buffered already costs nothing to skip */
+	left = t->rbuflen - t->rbufpos;
+	if ((off_t)left > len)
+		left = (size_t)len;
+	t->rbufpos += left;
+	t->offset += left;
+	len -= left;
+	if (len == 0)
+		return 0;
+
+	if (t->type->seekfunc != NULL && !t->noseek)
+	{
+		/* the descriptor sits at the end of the buffered data */
+		i = (*(t->type->seekfunc))(t->fd, len, SEEK_CUR);
+		if (i != -1)
+		{
+#ifdef DEBUG
+			printf("    tar_block_skip(): seeked over %lld bytes\n",
+			       (long long)len);
+#endif
+			t->rbufpos = t->rbuflen = 0;
+			t->offset += len;
+			return 0;
+		}
+		if (errno != ESPIPE)
+			return -1;
+
+		/* pipe or tape, fall back to reading */
+		t->noseek = 1;
+	}
+
+	while (len > 0)
+	{
+		k = tar_block_next(t, (len > (off_t)t->rbufsize
+				       ? t->rbufsize
+				       : (size_t)len), &buf);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		len -= k;
+	}
+
+	return 0;
+}
+
+
+/*
+** make room for at least one block at the end of the output buffer,
+** flushing it if it's full; *ptr is set to the first free byte
+** returns the number of free bytes, or -1 (and sets errno) on error
+*/
+ssize_t
+tar_block_space(TAR *t, char **ptr)
+{
+	if (t->wbuf == NULL)
+	{
+		if (t->wbufsize < T_BLOCKSIZE)
+			t->wbufsize = T_BLOCKSIZE;
+		t->wbuf = (char *)malloc(t->wbufsize);
+		if (t->wbuf == NULL)
+			return -1;
+	}
+
+	if (t->wbufsize - t->wbuflen < T_BLOCKSIZE && tar_flush(t) == -1)
+		return -1;
+
+	*ptr = t->wbuf + t->wbuflen;
+	return (t->wbufsize - t->wbuflen);
+}
+
+
+/* write a single block */
+int
+tar_block_write(TAR *t, const void *buf)
+{
+	char *ptr;
+
+	if (tar_block_space(t, &ptr) == -1)
+		return -1;
+	memcpy(ptr, buf, T_BLOCKSIZE);
+	t->wbuflen += T_BLOCKSIZE;
+
+	return T_BLOCKSIZE;
+}
+
+
+/* write out the output buffer */
+int
+tar_flush(TAR *t)
+{
+	size_t done = 0;
+	ssize_t i;
+
+	while (done < t->wbuflen)
+	{
+		i = (*(t->type->writefunc))(t->fd, t->wbuf + done,
+					    t->wbuflen - done);
+		if (i <= 0)
+		{
+			/* keep what wasn't written, in case it's retried */
+			memmove(t->wbuf, t->wbuf + done, t->wbuflen - done);
+			t->wbuflen -= done;
+			if (i == 0)
+				errno = EINVAL;
+			return -1;
+		}
+		done += i;
+	}
+#ifdef DEBUG
+	printf("    tar_flush(): wrote %zu bytes\n", done);
+#endif
+	t->wbuflen = 0;
+
+	return 0;
+}
+
+
+/*
+** parse a PAX time value ("seconds[.fraction]") into seconds and nanoseconds
+** returns 0 on success, or -1 if the value is malformed
+*/
+static int
+pax_parse_time(const char *value, time_t *sec, long *nsec)
+{
+	char *endptr;
+	long long s;
+	long ns = 0;
+	int digits = 0;
+
+	s = strtoll(value, &endptr, 10);
+	if (endptr == value)
+		return -1;
+	if (*endptr == '.')
+	{
+		for (endptr++; *endptr >= '0' && *endptr <= '9'; endptr++)
+		{
+			/* anything finer than a nanosecond is dropped */
+			if (digits++ < 9)
+				ns = ns * 10 + (*endptr - '0');
+		}
+		for (; digits < 9; digits++)
+			ns *= 10;
+
+		/* "-1.5" is one and a half seconds before the epoch */
+		if (value[0] == '-' && ns != 0)
+		{
+			s--;
+			ns = 1000000000L - ns;
+		}
+	}
+	if (*endptr != '\0')
+		return -1;
+
+	*sec = (time_t)s;
+	*nsec = ns;
+	return 0;
+}
+
+
+/*
+** parse a PAX decimal value
+** returns 0 on success, or -1 if the value is malformed
+*/
+static int
+pax_parse_number(const char *value, long long *num)
+{
+	char *endptr;
+
+	*num = strtoll(value, &endptr, 10);
+	if (endptr == value || *endptr != '\0')
+		return -1;
+
+	return 0;
+}
+
+
+/*
+** add or replace an extended attribute
+** global values live in their own allocation for the life of the handle,
+** per-file ones in the handle's xattr scratch buffer
+** returns 0 on success, or -1 (and sets errno) on error
+*/
+static int
+pax_set_xattr(TAR *t, struct tar_pax *pax, char *name,
+	      char *value, size_t len)
+{
+	struct tar_xattr *xa;
+	size_t size;
+	int i;
+
+	for (i = 0; i < pax->nxattrs; i++)
+	{
+		if (strcmp(pax->xattrs[i].name, name) == 0)
+			break;
+	}
+
+	if (i == pax->nxattrs)
+	{
+		size = (pax->nxattrs + 1) * sizeof(struct tar_xattr);
+		if (pax == &(t->pax_global))
+			xa = (struct tar_xattr *)realloc(pax->xattrs, size);
+		else
+			xa = (struct tar_xattr *)tar_scratch(t,
+							     TAR_SCRATCH_XATTR,
+							     size);
+		if (xa == NULL)
+			return -1;
+		pax->xattrs = xa;
+		pax->nxattrs++;
+	}
+
+	pax->xattrs[i].name = name;
+	pax->xattrs[i].value = value;
+	pax->xattrs[i].len = len;
+	return 0;
+}
+
+
+/* append a run of data to the sparse map of the current header */
+int
+th_sparse_add(TAR *t, off_t offset, off_t numbytes)
+{
+	struct tar_sparse *sp;
+
+	sp = (struct tar_sparse *)tar_scratch(t, TAR_SCRATCH_SPARSE,
+					      (t->th_buf.nsparse + 1)
+					      * sizeof(struct tar_sparse));
+	if (sp == NULL)
+		return -1;
+	t->th_buf.sparse = sp;
+	sp[t->th_buf.nsparse].offset = offset;
+	sp[t->th_buf.nsparse].numbytes = numbytes;
+	t->th_buf.nsparse++;
+
+	return 0;
+}
+
+
+/*
+** handle a GNU.sparse.* keyword; the map itself is only complete once the
+** whole header is parsed, see th_read_sparse()
+** returns 0 on success, or -1 (and sets errno) on error
+*/
+static int
+pax_parse_sparse(TAR *t, struct tar_pax *pax, char *key, char *value)
+{
+	long long num;
+
+	if (strcmp(key, "name") == 0)
+	{
+		pax->sparse_name = value;
+		return 0;
+	}
+	if (strcmp(key, "map") == 0)
+	{
+		pax->sparse_map = value;
+		pax->flags |= TAR_PAX_SPARSE;
+		return 0;
+	}
+
+	/* the rest are numbers; numblocks and minor aren't needed */
+	if (pax_parse_number(value, &num) != 0 || num < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (strcmp(key, "size") == 0 || strcmp(key, "realsize") == 0)
+		pax->sparse_size = (off_t)num;
+	else if (strcmp(key, "major") == 0)
+		pax->sparse_major = (int)num;
+	else if (strcmp(key, "offset") == 0)
+	{
+		/* format 0.0 repeats offset/numbytes pairs */
+		if (th_sparse_add(t, (off_t)num, 0) != 0)
+			return -1;
+	}
+	else if (strcmp(key, "numbytes") == 0)
+	{
+		if (t->th_buf.nsparse == 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		t->th_buf.sparse[t->th_buf.nsparse - 1].numbytes = (off_t)num;
+	}
+	else
+		return 0;
+
+	pax->flags |= TAR_PAX_SPARSE;
+	return 0;
+}
+
+
+/*
+** Parse PAX extended header data into pax.
 ** PAX format: "len key=value\n" where len includes the length field itself.
+** Keys and values are NUL-terminated in place and pointed to, so data must
+** stay around for as long as the values are in use.  An empty value
+** removes a value set by a global header.
 ** Returns 0 on success, -1 on error.
 */
 static int
-pax_parse_header(TAR *t, const char *data, size_t datalen)
+pax_parse_header(TAR *t, struct tar_pax *pax, char *data, size_t datalen)
 {
-	const char *p = data;
-	const char *end = data + datalen;
+	char *p = data;
+	char *end = data + datalen;
+	long long num;
 
 #ifdef DEBUG
 	printf("    pax_parse_header(): parsing %zu bytes\n", datalen);
@@ -41,8 +459,8 @@ pax_parse_header(TAR *t, const char *data, size_t datalen)
 
 	while (p < end && *p != '\0')
 	{
-		size_t len;
-		const char *key_start, *key_end, *value_start, *value_end;
+		size_t len, vallen;
+		char *key_start, *key_end, *value_start, *value_end;
 		char *endptr;
 
 		/* Parse length field */
@@ -67,10 +485,10 @@ pax_parse_header(TAR *t, const char *data, size_t datalen)
 		/* Find key=value pair */
 		key_start = endptr + 1;
 		key_end = memchr(key_start, '=', (p + len) - key_start);
-		if (key_end == NULL)
+		if (key_end == NULL || p[len - 1] != '\n')
 		{
 #ifdef DEBUG
-			printf("    pax_parse_header(): no '=' found in record\n");
+			printf("    pax_parse_header(): malformed record\n");
 #endif
 			p += len;
 			continue;
@@ -78,60 +496,81 @@ pax_parse_header(TAR *t, const char *data, size_t datalen)
 
 		value_start = key_end + 1;
 		value_end = p + len - 1; /* -1 for newline */
+		vallen = value_end - value_start;
+		*key_end = '\0';
+		*value_end = '\0';
+		p += len;
 
-		/* Skip if value is empty or malformed */
-		if (value_start >= value_end)
+#ifdef DEBUG
+		printf("    pax_parse_header(): key='%s' value='%.*s'\n",
+		       key_start, (int)vallen, value_start);
+#endif
+
+		if (strcmp(key_start, "path") == 0)
+			pax->path = (vallen ? value_start : NULL);
+		else if (strcmp(key_start, "linkpath") == 0)
+			pax->linkpath = (vallen ? value_start : NULL);
+		else if (strcmp(key_start, "uname") == 0)
+			pax->uname = (vallen ? value_start : NULL);
+		else if (strcmp(key_start, "gname") == 0)
+			pax->gname = (vallen ? value_start : NULL);
+		else if (strcmp(key_start, "size") == 0)
 		{
-			p += len;
-			continue;
+			pax->flags &= ~TAR_PAX_SIZE;
+			if (vallen && pax_parse_number(value_start, &num) == 0
+			    && num >= 0)
+			{
+				pax->size = (off_t)num;
+				pax->flags |= TAR_PAX_SIZE;
+			}
 		}
-
-#ifdef DEBUG
+		else if (strcmp(key_start, "mtime") == 0)
 		{
-			size_t keylen = key_end - key_start;
-			size_t vallen = value_end - value_start;
-			printf("    pax_parse_header(): key='%.*s' value='%.*s'\n",
-			       (int)keylen, key_start, (int)vallen, value_start);
+			pax->flags &= ~TAR_PAX_MTIME;
+			if (vallen && pax_parse_time(value_start, &(pax->mtime),
+						     &(pax->mtime_nsec)) == 0)
+				pax->flags |= TAR_PAX_MTIME;
 		}
-#endif
-
-		/* Check for 'path' keyword */
-		if ((size_t)(key_end - key_start) == 4 &&
-		    strncmp(key_start, "path", 4) == 0)
+		else if (strcmp(key_start, "atime") == 0)
+		{
+			pax->flags &= ~TAR_PAX_ATIME;
+			if (vallen && pax_parse_time(value_start, &(pax->atime),
+						     &(pax->atime_nsec)) == 0)
+				pax->flags |= TAR_PAX_ATIME;
+		}
+		else if (strcmp(key_start, "uid") == 0)
+		{
+			pax->flags &= ~TAR_PAX_UID;
+			if (vallen && pax_parse_number(value_start, &num) == 0)
+			{
+				pax->uid = (uid_t)num;
+				pax->flags |= TAR_PAX_UID;
+			}
+		}
+		else if (strcmp(key_start, "gid") == 0)
+		{
+			pax->flags &= ~TAR_PAX_GID;
+			if (vallen && pax_parse_number(value_start, &num) == 0)
+			{
+				pax->gid = (gid_t)num;
+				pax->flags |= TAR_PAX_GID;
+			}
+		}
+		else if (strncmp(key_start, "GNU.sparse.", 11) == 0
+			 && pax != &(t->pax_global))
 		{
-			size_t vallen = value_end - value_start;
-			if (t->th_buf.pax_path != NULL)
-				free(t->th_buf.pax_path);
-			t->th_buf.pax_path = (char *)malloc(vallen + 1);
-			if (t->th_buf.pax_path == NULL)
+			if (pax_parse_sparse(t, pax, key_start + 11,
+					     value_start) != 0)
 				return -1;
-			memcpy(t->th_buf.pax_path, value_start, vallen);
-			t->th_buf.pax_path[vallen] = '\0';
-#ifdef DEBUG
-			printf("    pax_parse_header(): set pax_path='%s'\n",
-			       t->th_buf.pax_path);
-#endif
 		}
-		/* Check for 'linkpath' keyword */
-		else if ((size_t)(key_end - key_start) == 8 &&
-		         strncmp(key_start, "linkpath", 8) == 0)
+		else if (strncmp(key_start, "SCHILY.xattr.", 13) == 0
+			 && key_start[13] != '\0')
 		{
-			size_t vallen = value_end - value_start;
-			if (t->th_buf.pax_linkpath != NULL)
-				free(t->th_buf.pax_linkpath);
-			t->th_buf.pax_linkpath = (char *)malloc(vallen + 1);
-			if (t->th_buf.pax_linkpath == NULL)
+			if (pax_set_xattr(t, pax, key_start + 13,
+					  value_start, vallen) != 0)
 				return -1;
-			memcpy(t->th_buf.pax_linkpath, value_start, vallen);
-			t->th_buf.pax_linkpath[vallen] = '\0';
-#ifdef DEBUG
-			printf("    pax_parse_header(): set pax_linkpath='%s'\n",
-			       t->th_buf.pax_linkpath);
-#endif
 		}
-		/* Other keywords (size, mtime, uid, gid, etc.) can be added here */
-
-		p += len;
+		/* other keywords (charset, comment, ctime, ...) are ignored */
 	}
 
 	return 0;
@@ -144,6 +583,7 @@ th_read_internal(TAR *t)
 {
 	int i;
 	int num_zero_blocks = 0;
+	int usum, ssum;
 
 #ifdef DEBUG
 	printf("==> th_read_internal(TAR=\"%s\")\n", t->pathname);
@@ -152,7 +592,7 @@ th_read_internal(TAR *t)
 	while ((i = tar_block_read(t, &(t->th_buf))) == T_BLOCKSIZE)
 	{
 		/* two all-zero blocks mark EOF */
-		if (t->th_buf.name[0] == '\0')
+		if (tar_block_sum(&(t->th_buf), &usum, &ssum))
 		{
 			num_zero_blocks++;
 			if (!BIT_ISSET(t->options, TAR_IGNORE_EOT)
@@ -183,7 +623,7 @@ th_read_internal(TAR *t)
 
 		/* check chksum */
 		if (!BIT_ISSET(t->options, TAR_IGNORE_CRC)
-		    && !th_crc_ok(t))
+		    && !th_crc_match(t, usum, ssum))
 		{
 #ifdef DEBUG
 			puts("!!! tar header checksum error");
@@ -201,223 +641,472 @@ th_read_internal(TAR *t)
 }
 
 
-/* wrapper function for th_read_internal() to handle GNU extensions */
-int
-th_read(TAR *t)
+/*
+** read the contents of a GNU long name/link or PAX header into one of the
+** handle's scratch buffers, NUL-terminated, then read the next header
+** returns 0 on success, 1 if the archive ends instead, or -1 (and sets
+** errno) on error
+*/
+static int
+th_read_ext(TAR *t, int slot, char **data, size_t *size)
 {
+	off_t sz;
+	size_t len;
+	ssize_t k;
+	char *buf, *ptr;
 	int i;
-	size_t sz, j, blocks;
-	char *ptr;
 
+	/* the size of the extension itself is never overridden by PAX */
+	sz = (off_t)th_get_field(t, size);
+	if (sz < 0 || (uint64_t)sz >= (size_t)-1 - T_BLOCKSIZE)
+	{
+		errno = E2BIG;
+		return -1;
+	}
 #ifdef DEBUG
-	printf("==> th_read(t=0x%lx)\n", t);
+	printf("    th_read_ext(): reading %lld bytes of '%c' data\n",
+	       (long long)sz, t->th_buf.typeflag);
 #endif
 
-	if (t->th_buf.gnu_longname != NULL)
-		free(t->th_buf.gnu_longname);
-	if (t->th_buf.gnu_longlink != NULL)
-		free(t->th_buf.gnu_longlink);
-	if (t->th_buf.pax_path != NULL)
-		free(t->th_buf.pax_path);
-	if (t->th_buf.pax_linkpath != NULL)
-		free(t->th_buf.pax_linkpath);
-	memset(&(t->th_buf), 0, sizeof(struct tar_header));
+	*size = (size_t)sz;
+	*data = tar_scratch(t, slot, *size + 1);
+	if (*data == NULL)
+		return -1;
+
+	for (ptr = *data; sz > 0; ptr += len, sz -= len)
+	{
+		k = tar_block_next(t, (size_t)sz, &buf);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		len = ((off_t)k > sz ? (size_t)sz : (size_t)k);
+		memcpy(ptr, buf, len);
+	}
+	*ptr = '\0';
 
 	i = th_read_internal(t);
 	if (i == 0)
 		return 1;
-	else if (i != T_BLOCKSIZE)
+	if (i != T_BLOCKSIZE)
 	{
 		if (i != -1)
 			errno = EINVAL;
 		return -1;
 	}
 
-	/* check for GNU long link extention */
-	if (TH_ISLONGLINK(t))
-	{
-		sz = th_get_size(t);
-		blocks = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
-		if (blocks > ((size_t)-1 / T_BLOCKSIZE))
-		{
-			errno = E2BIG;
-			return -1;
-		}
-#ifdef DEBUG
-		printf("    th_read(): GNU long linkname detected "
-		       "(%ld bytes, %d blocks)\n", sz, blocks);
-#endif
-		t->th_buf.gnu_longlink = (char *)malloc(blocks * T_BLOCKSIZE);
-		if (t->th_buf.gnu_longlink == NULL)
-			return -1;
+	return 0;
+}
+
+
+/* like th_read_ext(), but the extension must be followed by its entry */
+static int
+th_read_ext_entry(TAR *t, int slot, char **data, size_t *size)
+{
+	int i;
+
+	i = th_read_ext(t, slot, data, size);
+	if (i == 1)
+		errno = EINVAL;
+
+	return (i == 0 ? 0 : -1);
+}
+
+
+/*
+** start a new header off with the values of the global PAX headers
+** returns 0 on success, or -1 (and sets errno) on error
+*/
+static int
+th_read_pax_global(TAR *t)
+{
+	struct tar_xattr *xa;
+	int n;
+
+	t->th_buf.pax = t->pax_global;
+	t->th_buf.sparse = NULL;
+	t->th_buf.nsparse = 0;
+	n = t->pax_global.nxattrs;
+	if (n == 0)
+		return 0;
+
+	/* per-file xattrs are added to a copy, never to the global list */
+	xa = (struct tar_xattr *)tar_scratch(t, TAR_SCRATCH_XATTR,
+					     n * sizeof(struct tar_xattr));
+	if (xa == NULL)
+		return -1;
+	memcpy(xa, t->pax_global.xattrs, n * sizeof(struct tar_xattr));
+	t->th_buf.pax.xattrs = xa;
+
+	return 0;
+}
+
+
+/*
+** read a PAX global header into the handle, where it stays for the rest
+** of the archive
+** returns 0 on success, 1 if the archive ends, or -1 (and sets errno)
+** on error
+*/
+static int
+th_read_pax_globalhdr(TAR *t)
+{
+	char **gdata;
+	char *ptr;
+	size_t sz;
+	int i;
+
+	i = th_read_ext(t, TAR_SCRATCH_PAX, &ptr, &sz);
+	if (i != 0)
+		return i;
+
+	/* later global headers refer to earlier ones, so keep them all */
+	gdata = (char **)realloc(t->pax_gdata,
+				 (t->pax_ngdata + 1) * sizeof(char *));
+	if (gdata == NULL)
+		return -1;
+	t->pax_gdata = gdata;
+	gdata[t->pax_ngdata] = (char *)malloc(sz + 1);
+	if (gdata[t->pax_ngdata] == NULL)
+		return -1;
+	memcpy(gdata[t->pax_ngdata], ptr, sz + 1);
+	ptr = gdata[t->pax_ngdata++];
+
+	if (pax_parse_header(t, &(t->pax_global), ptr, sz) != 0)
+		return -1;
+
+	/*
+	** the header that follows was set up from the previous globals;
+	** per-file values seen before this header are dropped with them
+	*/
+	return th_read_pax_global(t);
+}
+
+
+/* old GNU sparse header layout, in the space of the ustar prefix field */
+#define GNU_SPARSE_OFFSET	386	/* 4 x { offset[12] numbytes[12] } */
+#define GNU_SPARSE_ENTRIES	4
+#define GNU_ISEXTENDED		482
+#define GNU_REALSIZE		483	/* realsize[12] */
+#define GNU_SPARSE_EXT_ENTRIES	21	/* per extension block */
+#define GNU_ISEXTENDED_EXT	504
+
 
-		for (j = 0, ptr = t->th_buf.gnu_longlink; j < blocks;
-		     j++, ptr += T_BLOCKSIZE)
+/*
+** read the sparse map of an old GNU 'S' header, including any extension
+** blocks that follow it
+*/
+static int
+th_read_gnu_sparse(TAR *t)
+{
+	char ext[T_BLOCKSIZE];
+	char *hdr = (char *)&(t->th_buf);
+	char *p;
+	int i, n, extended;
+
+	t->th_buf.realsize = (off_t)oct_to_int64(hdr + GNU_REALSIZE, 12);
+	p = hdr + GNU_SPARSE_OFFSET;
+	n = GNU_SPARSE_ENTRIES;
+	extended = hdr[GNU_ISEXTENDED];
+
+	for (;;)
+	{
+		/* unused entries are zero-filled */
+		for (i = 0; i < n && p[0] != '\0'; i++, p += 24)
 		{
-#ifdef DEBUG
-			printf("    th_read(): reading long linkname "
-			       "(%d blocks left, ptr == %ld)\n", blocks-j, ptr);
-#endif
-			i = tar_block_read(t, ptr);
-			if (i != T_BLOCKSIZE)
-			{
-				if (i != -1)
-					errno = EINVAL;
+			if (th_sparse_add(t, (off_t)oct_to_int64(p, 12),
+					  (off_t)oct_to_int64(p + 12, 12)) != 0)
 				return -1;
-			}
-#ifdef DEBUG
-			printf("    th_read(): read block == \"%s\"\n", ptr);
-#endif
 		}
-#ifdef DEBUG
-		printf("    th_read(): t->th_buf.gnu_longlink == \"%s\"\n",
-		       t->th_buf.gnu_longlink);
-#endif
+		if (!extended)
+			break;
 
-		i = th_read_internal(t);
-		if (i != T_BLOCKSIZE)
+		if (tar_block_read(t, ext) != T_BLOCKSIZE)
 		{
-			if (i != -1)
-				errno = EINVAL;
+			errno = EINVAL;
 			return -1;
 		}
+		p = ext;
+		n = GNU_SPARSE_EXT_ENTRIES;
+		extended = ext[GNU_ISEXTENDED_EXT];
+	}
+
+	return 0;
+}
+
+
+/* parse a format 0.1 GNU.sparse.map ("offset,numbytes,...") */
+static int
+th_read_sparse_01(TAR *t)
+{
+	char *p = t->th_buf.pax.sparse_map;
+	char *endptr;
+	long long offset, numbytes;
+
+	while (*p != '\0')
+	{
+		offset = strtoll(p, &endptr, 10);
+		if (endptr == p || *endptr != ',')
+			break;
+		p = endptr + 1;
+		numbytes = strtoll(p, &endptr, 10);
+		if (endptr == p || (*endptr != ',' && *endptr != '\0'))
+			break;
+		p = endptr + (*endptr == ',');
+
+		if (th_sparse_add(t, (off_t)offset, (off_t)numbytes) != 0)
+			return -1;
+	}
+	if (*p != '\0')
+	{
+		errno = EINVAL;
+		return -1;
 	}
 
-	/* check for GNU long name extention */
-	if (TH_ISLONGNAME(t))
+	return 0;
+}
+
+
+/*
+** read a format 1.0 sparse map, which is stored as decimal lines at the
+** start of the file data ("count\n" then "offset\nnumbytes\n" pairs) and
+** padded to a whole block; the archived size is adjusted to what's left
+*/
+static int
+th_read_sparse_10(TAR *t)
+{
+	off_t size, consumed = 0;
+	long long num = 0, count = -1, offset = 0;
+	int digits = 0, nums = 0;
+	ssize_t k, i;
+	char *buf;
+
+	size = th_hdr_size(t);
+	while (count < 0 || nums < 2 * count)
 	{
-		sz = th_get_size(t);
-		blocks = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
-		if (blocks > ((size_t)-1 / T_BLOCKSIZE))
+		if (consumed >= size)
+			goto bad;
+		k = tar_block_next(t, T_BLOCKSIZE, &buf);
+		if (k <= 0)
 		{
-			errno = E2BIG;
+			if (k != -1)
+				errno = EINVAL;
 			return -1;
 		}
-#ifdef DEBUG
-		printf("    th_read(): GNU long filename detected "
-		       "(%ld bytes, %d blocks)\n", sz, blocks);
-#endif
-		t->th_buf.gnu_longname = (char *)malloc(blocks * T_BLOCKSIZE);
-		if (t->th_buf.gnu_longname == NULL)
-			return -1;
+		consumed += k;
 
-		for (j = 0, ptr = t->th_buf.gnu_longname; j < blocks;
-		     j++, ptr += T_BLOCKSIZE)
+		for (i = 0; i < k && (count < 0 || nums < 2 * count); i++)
 		{
-#ifdef DEBUG
-			printf("    th_read(): reading long filename "
-			       "(%d blocks left, ptr == %ld)\n", blocks-j, ptr);
-#endif
-			i = tar_block_read(t, ptr);
-			if (i != T_BLOCKSIZE)
+			if (buf[i] >= '0' && buf[i] <= '9')
 			{
-				if (i != -1)
-					errno = EINVAL;
-				return -1;
+				if (++digits > 18)
+					goto bad;
+				num = num * 10 + (buf[i] - '0');
+				continue;
 			}
-#ifdef DEBUG
-			printf("    th_read(): read block == \"%s\"\n", ptr);
-#endif
+			if (buf[i] != '\n' || digits == 0)
+				goto bad;
+
+			if (count < 0)
+				count = num;
+			else if (nums++ % 2 == 0)
+				offset = num;
+			else if (th_sparse_add(t, (off_t)offset,
+					       (off_t)num) != 0)
+				return -1;
+			num = 0;
+			digits = 0;
 		}
-#ifdef DEBUG
-		printf("    th_read(): t->th_buf.gnu_longname == \"%s\"\n",
-		       t->th_buf.gnu_longname);
-#endif
+	}
 
-		i = th_read_internal(t);
-		if (i != T_BLOCKSIZE)
-		{
-			if (i != -1)
-				errno = EINVAL;
+	t->th_buf.pax.size = size - consumed;
+	t->th_buf.pax.flags |= TAR_PAX_SIZE;
+	return 0;
+
+ bad:
+	errno = EINVAL;
+	return -1;
+}
+
+
+/*
+** set up the sparse map of the current header from whichever GNU format
+** it uses, and check that it describes the archived data exactly
+** returns 0 on success, or -1 (and sets errno) on error
+*/
+static int
+th_read_sparse(TAR *t)
+{
+	struct tar_sparse *sp;
+	off_t end = 0, total = 0;
+	int i;
+
+	if (t->th_buf.typeflag == GNU_SPARSE_TYPE)
+	{
+		if (th_read_gnu_sparse(t) != 0)
 			return -1;
+	}
+	else
+	{
+		t->th_buf.realsize = t->th_buf.pax.sparse_size;
+		if (t->th_buf.pax.sparse_major == 1)
+		{
+			if (th_read_sparse_10(t) != 0)
+				return -1;
+		}
+		else if (t->th_buf.pax.sparse_map != NULL)
+		{
+			if (th_read_sparse_01(t) != 0)
+				return -1;
 		}
+		/* else format 0.0, whose map was built while parsing */
 	}
 
-	/* check for PAX extended header */
-	if (TH_ISPAX(t) || TH_ISPAXGLOBAL(t))
+	/* a file that's all hole still needs a (empty) map */
+	sp = (struct tar_sparse *)tar_scratch(t, TAR_SCRATCH_SPARSE,
+					      sizeof(struct tar_sparse));
+	if (sp == NULL)
+		return -1;
+	t->th_buf.sparse = sp;
+
+	for (i = 0; i < t->th_buf.nsparse; i++)
 	{
-		char *pax_path_saved = NULL;
-		char *pax_linkpath_saved = NULL;
+		if (sp[i].offset < end || sp[i].numbytes < 0
+		    || sp[i].numbytes > t->th_buf.realsize - sp[i].offset)
+			goto bad;
+		end = sp[i].offset + sp[i].numbytes;
+		total += sp[i].numbytes;
+	}
+	if (total != th_hdr_size(t))
+		goto bad;
 
-		sz = th_get_size(t);
-		blocks = (sz / T_BLOCKSIZE) + (sz % T_BLOCKSIZE ? 1 : 0);
-		if (blocks > ((size_t)-1 / T_BLOCKSIZE))
-		{
-			errno = E2BIG;
-			return -1;
-		}
 #ifdef DEBUG
-		printf("    th_read(): PAX extended header detected "
-		       "(%zu bytes, %zu blocks), typeflag='%c'\n",
-		       sz, blocks, t->th_buf.typeflag);
+	printf("    th_read_sparse(): %d data runs, %lld of %lld bytes\n",
+	       t->th_buf.nsparse, (long long)total,
+	       (long long)t->th_buf.realsize);
 #endif
-		ptr = (char *)malloc(blocks * T_BLOCKSIZE);
-		if (ptr == NULL)
-			return -1;
+	return 0;
+
+ bad:
+	errno = EINVAL;
+	return -1;
+}
+
+
+/* wrapper function for th_read_internal() to handle GNU extensions */
+int
+th_read(TAR *t)
+{
+	int i, pax = 0;
+	size_t sz;
+	char *ptr;
 
-		for (j = 0; j < blocks; j++)
-		{
 #ifdef DEBUG
-			printf("    th_read(): reading PAX block %zu of %zu\n",
-			       j + 1, blocks);
+	printf("==> th_read(t=0x%lx)\n", t);
 #endif
-			i = tar_block_read(t, ptr + (j * T_BLOCKSIZE));
-			if (i != T_BLOCKSIZE)
-			{
-				free(ptr);
-				if (i != -1)
-					errno = EINVAL;
-				return -1;
-			}
-		}
 
-		/* Parse PAX data */
-		if (pax_parse_header(t, ptr, sz) != 0)
+	/* the extension data lives in the handle's scratch buffers */
+	memset(&(t->th_buf), 0, sizeof(struct tar_header));
+	memset(&(t->cursor), 0, sizeof(struct tar_cursor));
+	if (th_read_pax_global(t) != 0)
+		return -1;
+
+	i = th_read_internal(t);
+	if (i == 0)
+		return 1;
+	else if (i != T_BLOCKSIZE)
+	{
+		if (i != -1)
+			errno = EINVAL;
+		return -1;
+	}
+	t->th_offset = t->offset - T_BLOCKSIZE;
+
+	/*
+	** extension headers describe the header that follows them, and
+	** may come in any order
+	*/
+	for (;;)
+	{
+		/* check for GNU long link extention */
+		if (TH_ISLONGLINK(t))
 		{
-			free(ptr);
-			return -1;
+			if (th_read_ext_entry(t, TAR_SCRATCH_LONGLINK, &ptr,
+					      &sz) != 0)
+				return -1;
+			t->th_buf.gnu_longlink = ptr;
+#ifdef DEBUG
+			printf("    th_read(): t->th_buf.gnu_longlink == \"%s\"\n",
+			       t->th_buf.gnu_longlink);
+#endif
 		}
 
-		/* Save pax values before reading next header */
-		if (t->th_buf.pax_path != NULL)
+		/* check for GNU long name extention */
+		else if (TH_ISLONGNAME(t))
 		{
-			pax_path_saved = t->th_buf.pax_path;
-			t->th_buf.pax_path = NULL;
+			if (th_read_ext_entry(t, TAR_SCRATCH_LONGNAME, &ptr,
+					      &sz) != 0)
+				return -1;
+			t->th_buf.gnu_longname = ptr;
+#ifdef DEBUG
+			printf("    th_read(): t->th_buf.gnu_longname == \"%s\"\n",
+			       t->th_buf.gnu_longname);
+#endif
 		}
-		if (t->th_buf.pax_linkpath != NULL)
+
+		/* check for PAX extended header */
+		else if (TH_ISPAX(t))
 		{
-			pax_linkpath_saved = t->th_buf.pax_linkpath;
-			t->th_buf.pax_linkpath = NULL;
+			/*
+			** the values are parsed in place, and the header that
+			** follows is read into th_buf without touching them;
+			** a second one reuses the buffer, so it starts over
+			*/
+			if (pax++ && th_read_pax_global(t) != 0)
+				return -1;
+			if (th_read_ext_entry(t, TAR_SCRATCH_PAX, &ptr, &sz) != 0)
+				return -1;
+			if (pax_parse_header(t, &(t->th_buf.pax), ptr, sz) != 0)
+				return -1;
 		}
 
-		free(ptr);
-
-		/* Read the actual file header that follows */
-		i = th_read_internal(t);
-		if (i != T_BLOCKSIZE)
+		/* check for PAX global header */
+		else if (TH_ISPAXGLOBAL(t))
 		{
-			if (pax_path_saved != NULL)
-				free(pax_path_saved);
-			if (pax_linkpath_saved != NULL)
-				free(pax_linkpath_saved);
-			if (i != -1)
-				errno = EINVAL;
-			return -1;
+			/* an archive may end with a global header */
+			i = th_read_pax_globalhdr(t);
+			if (i != 0)
+				return i;
+			pax = 0;
 		}
 
-		/* Restore saved pax values to the new header */
-		t->th_buf.pax_path = pax_path_saved;
-		t->th_buf.pax_linkpath = pax_linkpath_saved;
+		else
+			break;
+	}
+
+	if ((t->th_buf.typeflag == GNU_SPARSE_TYPE
+	     || (t->th_buf.pax.flags & TAR_PAX_SPARSE))
+	    && th_read_sparse(t) != 0)
+		return -1;
 
+	t->th_buf.pax_path = (t->th_buf.pax.sparse_name != NULL
+			      ? t->th_buf.pax.sparse_name
+			      : t->th_buf.pax.path);
+	t->th_buf.pax_linkpath = t->th_buf.pax.linkpath;
 #ifdef DEBUG
-		if (t->th_buf.pax_path != NULL)
-			printf("    th_read(): PAX path restored: '%s'\n",
-			       t->th_buf.pax_path);
-		if (t->th_buf.pax_linkpath != NULL)
-			printf("    th_read(): PAX linkpath restored: '%s'\n",
-			       t->th_buf.pax_linkpath);
+	if (t->th_buf.pax_path != NULL)
+		printf("    th_read(): PAX path: '%s'\n", t->th_buf.pax_path);
+	if (t->th_buf.pax_linkpath != NULL)
+		printf("    th_read(): PAX linkpath: '%s'\n",
+		       t->th_buf.pax_linkpath);
 #endif
-	}
+	th_decode(t);
+
+	/* the contents are read from the start */
+	if (TH_ISREG(t) && th_get_size(t) > 0)
+		t->cursor.left = th_get_size(t);
 
 #if 0
 	/*
@@ -458,13 +1147,89 @@ th_read(TAR *t)
 }
 
 
+/* append a PAX record */
+int
+th_pax_record(TAR *t, size_t *len, const char *key, const char *value)
+{
+	size_t n, d, total;
+	char *p;
+
+	/* the length counts its own digits */
+	n = strlen(key) + strlen(value) + 3;
+	for (d = 1, total = 10; n + d >= total; d++, total *= 10)
+		;
+	n += d;
+
+	p = tar_scratch(t, TAR_SCRATCH_PAX, *len + n + 1);
+	if (p == NULL)
+		return -1;
+	snprintf(p + *len, n + 1, "%zu %s=%s\n", n, key, value);
+	*len += n;
+
+	return 0;
+}
+
+
+/* write a PAX extended header */
+int
+th_write_pax(TAR *t, size_t len)
+{
+	struct tar_header save;
+	char buf[T_BLOCKSIZE];
+	char *ptr;
+	int i;
+
+	/* the extended header borrows everything but the name from th_buf */
+	save = t->th_buf;
+	t->th_buf.gnu_longname = NULL;
+	t->th_buf.gnu_longlink = NULL;
+	memset(t->th_buf.name, 0, sizeof(t->th_buf.name));
+	memset(t->th_buf.linkname, 0, sizeof(t->th_buf.linkname));
+	memset(t->th_buf.prefix, 0, sizeof(t->th_buf.prefix));
+	strcpy(t->th_buf.name, "././@PaxHeader");
+	t->th_buf.typeflag = PAX_EXTHDR_TYPE;
+	th_set_size(t, len);
+	th_finish(t);
+	i = tar_block_write(t, &(t->th_buf));
+	t->th_buf = save;
+	if (i != T_BLOCKSIZE)
+		goto fail;
+
+	for (ptr = t->scratch[TAR_SCRATCH_PAX]; len > 0; ptr += T_BLOCKSIZE)
+	{
+		if (len < T_BLOCKSIZE)
+		{
+			memset(buf, 0, T_BLOCKSIZE);
+			memcpy(buf, ptr, len);
+			i = tar_block_write(t, buf);
+			len = 0;
+		}
+		else
+		{
+			i = tar_block_write(t, ptr);
+			len -= T_BLOCKSIZE;
+		}
+		if (i != T_BLOCKSIZE)
+			goto fail;
+	}
+
+	return 0;
+
+ fail:
+	if (i != -1)
+		errno = EINVAL;
+	return -1;
+}
+
+
 /* write a header block */
 int
 th_write(TAR *t)
 {
 	int i, j;
 	char type2;
-	size_t sz, sz2;
+	size_t sz;
+	off_t sz2;
 	char *ptr;
 	char buf[T_BLOCKSIZE];
 
@@ -481,7 +1246,7 @@ th_write(TAR *t)
 #endif
 		/* save old size and type */
 		type2 = t->th_buf.typeflag;
-		sz2 = th_get_size(t);
+		sz2 = th_hdr_size(t);
 
 		/* write out initial header block with fake size and type */
 		t->th_buf.typeflag = GNU_LONGLINK_TYPE;
@@ -532,7 +1297,7 @@ th_write(TAR *t)
 #endif
 		/* save old size and type */
 		type2 = t->th_buf.typeflag;
-		sz2 = th_get_size(t);
+		sz2 = th_hdr_size(t);
 
 		/* write out initial header block with fake size and type */
 		t->th_buf.typeflag = GNU_LONGNAME_TYPE;
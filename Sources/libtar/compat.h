@@ -195,6 +195,14 @@ int inet_aton(const char *, struct in_addr *);
 #endif /* NEED_MAKEDEV */
 
 
+/* modification time of a struct stat, with nanoseconds */
+#ifdef __APPLE__
+# define compat_st_mtim(s)	((s)->st_mtimespec)
+#else
+# define compat_st_mtim(s)	((s)->st_mtim)
+#endif
+
+
 #if defined(NEED_SNPRINTF) && !defined(HAVE_SNPRINTF)
 
 int mutt_snprintf(char *, size_t, const char *, ...);
@@ -14,111 +14,192 @@
 
 #include <stdio.h>
 #include <sys/param.h>
-#include <pwd.h>
-#include <grp.h>
 
 #ifdef STDC_HEADERS
 # include <string.h>
 #endif
 
 
-/* determine full path name */
-char *
-th_get_pathname(TAR *t)
+/* the type bits a header's mode leaves out, from its typeflag */
+static mode_t
+th_decode_mode(TAR *t, mode_t mode)
 {
-	static TLS_THREAD char filename[MAXPATHLEN];
+	size_t len;
 
-	/* PAX path takes highest priority */
-	if (t->th_buf.pax_path)
-		return t->th_buf.pax_path;
+	if (mode & S_IFMT)
+		return mode;
+
+	switch (t->th_buf.typeflag)
+	{
+	case SYMTYPE:
+		return (mode | S_IFLNK);
+	case CHRTYPE:
+		return (mode | S_IFCHR);
+	case BLKTYPE:
+		return (mode | S_IFBLK);
+	case DIRTYPE:
+		return (mode | S_IFDIR);
+	case FIFOTYPE:
+		return (mode | S_IFIFO);
+	case AREGTYPE:
+		len = strnlen(t->th_buf.name, sizeof(t->th_buf.name));
+		if (len > 0 && t->th_buf.name[len - 1] == '/')
+			return (mode | S_IFDIR);
+		/* FALLTHROUGH */
+	default:
+		return (mode | S_IFREG);
+	}
+}
+
+
+/* the entry type, tried in the order tar_extract_file() always has */
+static int
+th_decode_type(TAR *t, mode_t rawmode)
+{
+	char type = t->th_buf.typeflag;
+	size_t len;
+
+	len = strnlen(t->th_buf.name, sizeof(t->th_buf.name));
+	if (type == DIRTYPE || S_ISDIR(rawmode)
+	    || (type == AREGTYPE && len > 0 && t->th_buf.name[len - 1] == '/'))
+		return TAR_TYPE_DIR;
+	if (type == LNKTYPE)
+		return TAR_TYPE_LNK;
+	if (type == SYMTYPE || S_ISLNK(rawmode))
+		return TAR_TYPE_SYM;
+	if (type == CHRTYPE || S_ISCHR(rawmode))
+		return TAR_TYPE_CHR;
+	if (type == BLKTYPE || S_ISBLK(rawmode))
+		return TAR_TYPE_BLK;
+	if (type == FIFOTYPE || S_ISFIFO(rawmode))
+		return TAR_TYPE_FIFO;
+	if (type == REGTYPE || type == AREGTYPE || type == CONTTYPE
+	    || type == GNU_SPARSE_TYPE || S_ISREG(rawmode))
+		return TAR_TYPE_REG;
+	return TAR_TYPE_OTHER;
+}
+
+
+void
+th_decode(TAR *t)
+{
+	struct tar_header *h = &(t->th_buf);
+	struct tar_entry *e = &(t->entry);
+	mode_t rawmode;
+
+	rawmode = th_get_rawmode(t);
+	e->type = th_decode_type(t, rawmode);
+	e->mode = th_decode_mode(t, rawmode);
+
+	e->size = th_hdr_size(t);
+	e->realsize = (h->sparse != NULL ? h->realsize : e->size);
+
+	if (h->pax.flags & TAR_PAX_MTIME)
+	{
+		e->mtime = h->pax.mtime;
+		e->mtime_nsec = h->pax.mtime_nsec;
+	}
+	else
+	{
+		e->mtime = (time_t)th_get_field(t, mtime);
+		e->mtime_nsec = 0;
+	}
+	if (h->pax.flags & TAR_PAX_ATIME)
+	{
+		e->atime = h->pax.atime;
+		e->atime_nsec = h->pax.atime_nsec;
+	}
+	else
+	{
+		e->atime = e->mtime;
+		e->atime_nsec = e->mtime_nsec;
+	}
 
-	if (t->th_buf.gnu_longname)
-		return t->th_buf.gnu_longname;
+	e->uid = ((h->pax.flags & TAR_PAX_UID) ? (uid_t)h->pax.uid
+		  : (uid_t)th_get_field(t, uid));
+	e->gid = ((h->pax.flags & TAR_PAX_GID) ? (gid_t)h->pax.gid
+		  : (gid_t)th_get_field(t, gid));
+	e->devmajor = (unsigned long)th_get_field(t, devmajor);
+	e->devminor = (unsigned long)th_get_field(t, devminor);
 
-	if (t->th_buf.prefix[0] != '\0')
+	/* PAX path takes highest priority */
+	if (h->pax_path != NULL)
+		e->pathname = h->pax_path;
+	else if (h->gnu_longname != NULL)
+		e->pathname = h->gnu_longname;
+	else
 	{
-		snprintf(filename, sizeof(filename), "%.155s/%.100s",
-			 t->th_buf.prefix, t->th_buf.name);
-		return filename;
+		/* old GNU headers keep times and sparse data in the prefix */
+		if (h->prefix[0] != '\0' && memcmp(h->magic, "ustar  ", 8) != 0)
+			snprintf(e->namebuf, sizeof(e->namebuf),
+				 "%.155s/%.100s", h->prefix, h->name);
+		else
+			snprintf(e->namebuf, sizeof(e->namebuf), "%.100s",
+				 h->name);
+		e->pathname = e->namebuf;
 	}
 
-	snprintf(filename, sizeof(filename), "%.100s", t->th_buf.name);
-	return filename;
+	if (h->pax_linkpath != NULL)
+		e->linkname = h->pax_linkpath;
+	else if (h->gnu_longlink != NULL)
+		e->linkname = h->gnu_longlink;
+	else
+	{
+		snprintf(e->linkbuf, sizeof(e->linkbuf), "%.100s",
+			 h->linkname);
+		e->linkname = e->linkbuf;
+	}
+}
+
+
+/* determine full path name */
+char *
+th_get_pathname(TAR *t)
+{
+	return t->entry.pathname;
 }
 
 
 uid_t
 th_get_uid(TAR *t)
 {
-	int uid;
-	struct passwd *pw;
+	char name[sizeof(t->th_buf.uname) + 1];
+	uid_t uid;
 
-	pw = getpwnam(t->th_buf.uname);
-	if (pw != NULL)
-		return pw->pw_uid;
+	if (!(t->options & TAR_NUMERIC_OWNER))
+	{
+		snprintf(name, sizeof(name), "%.32s", t->th_buf.uname);
+		if (tar_id_uid(t, (t->th_buf.pax.uname != NULL
+				   ? t->th_buf.pax.uname : name), &uid))
+			return uid;
+	}
 
 	/* if the password entry doesn't exist */
-	sscanf(t->th_buf.uid, "%o", &uid);
-	return uid;
+	return t->entry.uid;
 }
 
 
 gid_t
 th_get_gid(TAR *t)
 {
-	int gid;
-	struct group *gr;
+	char name[sizeof(t->th_buf.gname) + 1];
+	gid_t gid;
 
-	gr = getgrnam(t->th_buf.gname);
-	if (gr != NULL)
-		return gr->gr_gid;
+	if (!(t->options & TAR_NUMERIC_OWNER))
+	{
+		snprintf(name, sizeof(name), "%.32s", t->th_buf.gname);
+		if (tar_id_gid(t, (t->th_buf.pax.gname != NULL
+				   ? t->th_buf.pax.gname : name), &gid))
+			return gid;
+	}
 
 	/* if the group entry doesn't exist */
-	sscanf(t->th_buf.gid, "%o", &gid);
-	return gid;
+	return t->entry.gid;
 }
 
 
 mode_t
 th_get_mode(TAR *t)
 {
-	mode_t mode;
-
-	mode = (mode_t)oct_to_int(t->th_buf.mode);
-	if (! (mode & S_IFMT))
-	{
-		switch (t->th_buf.typeflag)
-		{
-		case SYMTYPE:
-			mode |= S_IFLNK;
-			break;
-		case CHRTYPE:
-			mode |= S_IFCHR;
-			break;
-		case BLKTYPE:
-			mode |= S_IFBLK;
-			break;
-		case DIRTYPE:
-			mode |= S_IFDIR;
-			break;
-		case FIFOTYPE:
-			mode |= S_IFIFO;
-			break;
-		case AREGTYPE:
-			if (t->th_buf.name[strlen(t->th_buf.name) - 1] == '/')
-			{
-				mode |= S_IFDIR;
-				break;
-			}
-			/* FALLTHROUGH */
-		case LNKTYPE:
-		case REGTYPE:
-		default:
-			mode |= S_IFREG;
-		}
-	}
-
-	return mode;
+	return t->entry.mode;
 }
-
-
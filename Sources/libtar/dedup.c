@@ -0,0 +1,294 @@
+/*
+**  dedup.c - libtar code to extract identical payloads only once
+**
+**  With TAR_DEDUP, tar_extract_regfile() hashes every payload it writes
+**  and records it here by hash and size.  When a later payload is in
+**  memory in full (a mapped archive, or one that fits in what's left of
+**  the read-ahead buffer) and matches one of them byte for byte, the
+**  earlier file is cloned (FICLONE, fclonefileat()) instead, or with
+**  TAR_DEDUP_HARDLINK linked to when clones aren't available and the
+**  two entries' metadata is the same.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/param.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+#ifdef __APPLE__
+# include <sys/clonefile.h>
+#endif
+
+
+/* a payload written by tar_extract_regfile() */
+struct tar_payload
+{
+	uint64_t hash;
+	off_t size;
+	char *realname;
+	struct tar_meta meta;
+};
+
+
+static unsigned int
+payload_hashfunc(struct tar_payload *p, unsigned int numbuckets)
+{
+	return ((unsigned int)(p->hash ^ (p->hash >> 32)) % numbuckets);
+}
+
+
+static int
+payload_match(struct tar_payload *key, struct tar_payload *p)
+{
+	return (key->hash == p->hash && key->size == p->size);
+}
+
+
+/* continue the hash of a payload with its next len bytes */
+uint64_t
+tar_dedup_hash(uint64_t h, const char *buf, size_t len)
+{
+	uint64_t w;
+
+	/* a word at a time; only the last piece of a payload is ragged */
+	for (; len >= sizeof(w); buf += sizeof(w), len -= sizeof(w))
+	{
+		memcpy(&w, buf, sizeof(w));
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	for (; len > 0; buf++, len--)
+		h = (h ^ (unsigned char)*buf) * 0x100000001b3ULL;
+
+	return h;
+}
+
+
+/* record a payload that has been written to realname */
+int
+tar_dedup_add(TAR *t, uint64_t hash, off_t size, const char *realname,
+	      const struct tar_meta *m)
+{
+	struct tar_payload *p;
+
+	if (t->dedup == NULL)
+	{
+		t->dedup = libtar_hash_new(256,
+				(libtar_hashfunc_t)payload_hashfunc);
+		if (t->dedup == NULL)
+			return -1;
+	}
+
+	p = (struct tar_payload *)tar_arena_alloc(t, sizeof(*p));
+	if (p == NULL)
+		return -1;
+	p->realname = tar_arena_strdup(t, realname);
+	if (p->realname == NULL)
+		return -1;
+	p->hash = hash;
+	p->size = size;
+	p->meta = *m;
+
+	return libtar_hash_add(t->dedup, p);
+}
+
+
+/*
+** open the file a payload was written to, if it still holds the same
+** size bytes as buf
+*/
+static int
+dedup_open(TAR *t, struct tar_payload *p, const char *buf, off_t size)
+{
+	char base[MAXPATHLEN];
+	char cmp[16384];
+	struct stat s;
+	off_t off;
+	ssize_t k;
+	int dirfd, fd;
+
+	dirfd = tar_dir_parent(t, p->realname, base, sizeof(base));
+	if (dirfd == -1)
+		return -1;
+	fd = openat(dirfd, base, O_RDONLY
+		    | ((t->options & TAR_RESOLVE_BENEATH) ? O_NOFOLLOW : 0));
+	if (fd == -1)
+		return -1;
+
+	/* it may have been replaced since, or the hashes collide */
+	if (fstat(fd, &s) == -1 || !S_ISREG(s.st_mode) || s.st_size != size)
+	{
+		close(fd);
+		return -1;
+	}
+	for (off = 0; off < size; off += k)
+	{
+		k = pread(fd, cmp, (size - off > (off_t)sizeof(cmp)
+				    ? sizeof(cmp) : (size_t)(size - off)), off);
+		if (k <= 0 || memcmp(cmp, buf + off, k) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+
+/*
+** make filename a clone of srcfd and give it the metadata in m
+** returns 1 on success, 0 if clones aren't available here, or -1 (and
+** sets errno) on error
+*/
+static int
+dedup_clone(TAR *t, int srcfd, char *filename, const struct tar_meta *m)
+{
+#if defined(FICLONE) || defined(__APPLE__)
+	char base[MAXPATHLEN];
+	int dirfd, fd, err;
+
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1)
+		return -1;
+
+# ifdef FICLONE
+	fd = tar_extract_open(t, dirfd, base);
+	if (fd == -1)
+		return -1;
+	if (ioctl(fd, FICLONE, srcfd) == -1)
+	{
+		err = errno;
+		close(fd);
+		if (err == EOPNOTSUPP || err == ENOTTY || err == EINVAL)
+			t->nokcopy |= KCOPY_NO_CLONE;
+		else if (err != EXDEV)
+		{
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+	if (tar_apply_fmeta(fd, m) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	if (close(fd) == -1)
+		return -1;
+# else /* __APPLE__ */
+	if (unlinkat(dirfd, base, 0) == -1 && errno != ENOENT)
+		return -1;
+	if (fclonefileat(srcfd, dirfd, base, 0) == -1)
+	{
+		err = errno;
+		if (err == ENOTSUP)
+			t->nokcopy |= KCOPY_NO_CLONE;
+		else if (err != EXDEV)
+			return -1;
+		return 0;
+	}
+	if (tar_apply_meta(dirfd, base, m) == -1)
+		return -1;
+# endif
+
+	return 1;
+#else
+	t->nokcopy |= KCOPY_NO_CLONE;
+	return 0;
+#endif
+}
+
+
+/* a hardlink shares the inode, so it's only right if nothing differs */
+static int
+dedup_meta_match(const struct tar_meta *a, const struct tar_meta *b)
+{
+	return (a->mode == b->mode
+		&& (!a->chown || (a->uid == b->uid && a->gid == b->gid))
+		&& a->times[1].tv_sec == b->times[1].tv_sec
+		&& a->times[1].tv_nsec == b->times[1].tv_nsec);
+}
+
+
+/* extract a payload held in memory as a copy of an identical file */
+int
+tar_dedup_extract(TAR *t, uint64_t hash, const char *buf, off_t size,
+		  char *filename, const struct tar_meta *m)
+{
+	struct tar_payload key, *p = NULL;
+	libtar_hashptr_t hp;
+	struct stat s, ds;
+	char base[MAXPATHLEN];
+	int dirfd, fd = -1, i = 0;
+
+	/* nothing can be done with a copy if it has to be written anyway */
+	if (t->dedup == NULL
+	    || ((t->nokcopy & KCOPY_NO_CLONE)
+		&& !(t->options & TAR_DEDUP_HARDLINK)))
+		return 0;
+
+	key.hash = hash;
+	key.size = size;
+	libtar_hashptr_reset(&hp);
+	while (fd == -1
+	       && libtar_hash_getkey(t->dedup, &hp, &key,
+				     (libtar_matchfunc_t)payload_match) != 0)
+	{
+		p = (struct tar_payload *)libtar_hashptr_data(&hp);
+		fd = dedup_open(t, p, buf, size);
+	}
+	if (fd == -1)
+		return 0;
+
+	/* the copy may be this very file, when an entry comes twice */
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1 || fstat(fd, &s) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	if (fstatat(dirfd, base, &ds, AT_SYMLINK_NOFOLLOW) == 0
+	    && ds.st_dev == s.st_dev && ds.st_ino == s.st_ino)
+	{
+		close(fd);
+		return 0;
+	}
+
+#ifdef DEBUG
+	printf("    tar_dedup_extract(): %s has the same contents as %s\n",
+	       filename, p->realname);
+#endif
+	if (!(t->nokcopy & KCOPY_NO_CLONE))
+		i = dedup_clone(t, fd, filename, m);
+	close(fd);
+
+	if (i == 0 && (t->options & TAR_DEDUP_HARDLINK)
+	    && dedup_meta_match(&(p->meta), m))
+	{
+		dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+		if (dirfd == -1
+		    || (unlinkat(dirfd, base, 0) == -1 && errno != ENOENT)
+		    || tar_extract_linkto(t, p->realname, filename, NULL) == -1)
+			return -1;
+		i = 1;
+	}
+
+	return i;
+}
@@ -0,0 +1,494 @@
+/*
+**  dircache.c - libtar code to keep the directories being extracted into
+**  open, so that entries can be created relative to their parent
+**
+**  Directories are looked up by path in a small direct-mapped table of
+**  open descriptors.  A miss opens the directory in one call, and only
+**  when it doesn't exist are its parents looked up (recursively, through
+**  the same table) and the missing components created with mkdirat().
+**
+**  With TAR_RESOLVE_BENEATH, paths are resolved beneath the extraction
+**  root: openat2(RESOLVE_BENEATH) where the kernel has it, otherwise one
+**  component at a time without following symlinks.
+**
+**  The mode and times of extracted directories are held back until the
+**  extraction is finished, so that a read-only directory can still be
+**  written into and adding entries doesn't undo its modification time.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/param.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/openat2.h>)
+#  include <sys/syscall.h>
+#  include <linux/openat2.h>
+#  ifdef SYS_openat2
+#   define HAVE_OPENAT2 1
+#  endif
+# endif
+#endif
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC	0
+#endif
+
+#define DIR_OFLAGS	(O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+
+/* number of cached directories; a power of two */
+#define TAR_DIRCACHE_SIZE	64
+
+
+struct tar_dirslot
+{
+	char *path;		/* relative to the root, not NUL-terminated */
+	size_t len;
+	int fd;
+};
+
+/* a directory whose metadata is still to be applied */
+struct tar_dirmeta
+{
+	char *path;
+	int depth;		/* number of components */
+	size_t seq;		/* position in the archive */
+	struct tar_meta meta;
+};
+
+struct tar_dircache
+{
+	char *root;		/* extraction root (TAR_RESOLVE_BENEATH only) */
+	size_t rootlen;
+	int rootfd;		/* AT_FDCWD when there is no root */
+	int cwdknown;		/* the slots were opened in cwddev/cwdino */
+	dev_t cwddev;
+	ino_t cwdino;
+	int noopenat2;		/* openat2() isn't available */
+	struct tar_dirslot slot[TAR_DIRCACHE_SIZE];
+	struct tar_dirmeta *dirmeta;	/* pending directory metadata */
+	size_t ndirmeta;
+	size_t dirmetasize;
+};
+
+
+static void
+dircache_flush(struct tar_dircache *dc)
+{
+	int i;
+
+	for (i = 0; i < TAR_DIRCACHE_SIZE; i++)
+	{
+		if (dc->slot[i].path == NULL)
+			continue;
+		close(dc->slot[i].fd);
+		free(dc->slot[i].path);
+		dc->slot[i].path = NULL;
+	}
+}
+
+
+static struct tar_dircache *
+dircache_get(TAR *t)
+{
+	if (t->dircache == NULL)
+	{
+		t->dircache = (struct tar_dircache *)calloc(1,
+						sizeof(struct tar_dircache));
+		if (t->dircache == NULL)
+			return NULL;
+		t->dircache->rootfd = AT_FDCWD;
+	}
+
+	return t->dircache;
+}
+
+
+/*
+** with no root, relative paths are resolved against the working directory;
+** forget the directories opened against another one
+*/
+static int
+dircache_cwd(struct tar_dircache *dc)
+{
+	struct stat s;
+
+	if (stat(".", &s) == -1)
+		return -1;
+	if (dc->cwdknown && s.st_dev == dc->cwddev && s.st_ino == dc->cwdino)
+		return 0;
+
+	dircache_flush(dc);
+	dc->cwddev = s.st_dev;
+	dc->cwdino = s.st_ino;
+	dc->cwdknown = 1;
+	return 0;
+}
+
+
+/* open an existing directory in a single call, beneath the root if need be */
+static int
+dircache_open(TAR *t, struct tar_dircache *dc, const char *path)
+{
+#ifdef HAVE_OPENAT2
+	struct open_how how;
+	int fd;
+#endif
+
+	if (!(t->options & TAR_RESOLVE_BENEATH))
+		return openat(dc->rootfd, path, DIR_OFLAGS);
+
+#ifdef HAVE_OPENAT2
+	if (!dc->noopenat2)
+	{
+		memset(&how, 0, sizeof(how));
+		how.flags = DIR_OFLAGS;
+		how.resolve = RESOLVE_BENEATH;
+		fd = (int)syscall(SYS_openat2, dc->rootfd, path, &how,
+				  sizeof(how));
+		if (fd != -1 || errno != ENOSYS)
+			return fd;
+		dc->noopenat2 = 1;
+	}
+#endif
+
+	/* make the caller walk the path one component at a time */
+	errno = ENOENT;
+	return -1;
+}
+
+
+/*
+** return a descriptor for the directory named by the first len bytes of
+** path, opening and creating it as needed; it stays owned by the cache
+*/
+static int
+dircache_lookup(TAR *t, struct tar_dircache *dc, char *path, size_t len)
+{
+	struct tar_dirslot *s;
+	unsigned int h = 2166136261U;
+	size_t i, plen;
+	char *comp, save;
+	int fd, pfd;
+
+	if (len == 0)
+		return dc->rootfd;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)path[i];
+		h *= 16777619U;
+	}
+	s = &(dc->slot[h & (TAR_DIRCACHE_SIZE - 1)]);
+	if (s->path != NULL && s->len == len
+	    && memcmp(s->path, path, len) == 0)
+		return s->fd;
+
+	save = path[len];
+	path[len] = '\0';
+	fd = dircache_open(t, dc, path);
+	if (fd == -1 && errno == ENOENT)
+	{
+		/* find the parent, and create this component in it */
+		comp = strrchr(path, '/');
+		if (comp == NULL)
+		{
+			plen = 0;
+			comp = path;
+		}
+		else
+		{
+			plen = (comp == path ? 1 : (size_t)(comp - path));
+			while (plen > 1 && path[plen - 1] == '/')
+				plen--;
+			comp++;
+		}
+
+		pfd = dircache_lookup(t, dc, path, plen);
+		if (pfd != -1
+		    && (mkdirat(pfd, comp, 0777) == 0 || errno == EEXIST))
+			fd = openat(pfd, comp, DIR_OFLAGS
+				    | ((t->options & TAR_RESOLVE_BENEATH)
+				       ? O_NOFOLLOW : 0));
+	}
+	path[len] = save;
+	if (fd == -1)
+		return -1;
+
+	/* the parent's slot may be reused now that it's no longer needed */
+	if (s->path != NULL)
+	{
+		close(s->fd);
+		free(s->path);
+	}
+	s->path = (char *)malloc(len);
+	if (s->path == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+	memcpy(s->path, path, len);
+	s->len = len;
+	s->fd = fd;
+
+	return fd;
+}
+
+
+/* reject paths that could leave the root */
+static int
+dircache_check(const char *path)
+{
+	const char *p;
+
+	if (path[0] == '/')
+		return -1;
+	for (p = path; *p != '\0'; p++)
+	{
+		if (p[0] == '.' && p[1] == '.'
+		    && (p == path || p[-1] == '/')
+		    && (p[2] == '/' || p[2] == '\0'))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/* deepest first; archive order among entries for the same directory */
+static int
+dirmeta_cmp(const void *a, const void *b)
+{
+	const struct tar_dirmeta *da = (const struct tar_dirmeta *)a;
+	const struct tar_dirmeta *db = (const struct tar_dirmeta *)b;
+
+	if (da->depth != db->depth)
+		return (da->depth > db->depth ? -1 : 1);
+	return (da->seq < db->seq ? -1 : (da->seq > db->seq));
+}
+
+
+/* hold back the metadata of an extracted directory */
+int
+tar_dir_defer(TAR *t, const char *path, const struct tar_meta *m)
+{
+	struct tar_dircache *dc;
+	struct tar_dirmeta *dm;
+	const char *p;
+	size_t n;
+
+	dc = dircache_get(t);
+	if (dc == NULL)
+		return -1;
+
+	if (dc->ndirmeta == dc->dirmetasize)
+	{
+		n = (dc->dirmetasize ? dc->dirmetasize * 2 : 64);
+		dm = (struct tar_dirmeta *)realloc(dc->dirmeta,
+						   n * sizeof(*dm));
+		if (dm == NULL)
+			return -1;
+		dc->dirmeta = dm;
+		dc->dirmetasize = n;
+	}
+
+	dm = &(dc->dirmeta[dc->ndirmeta]);
+	dm->path = strdup(path);
+	if (dm->path == NULL)
+		return -1;
+	dm->depth = 0;
+	for (p = path; *p != '\0'; p++)
+		if (*p != '/' && (p == path || p[-1] == '/'))
+			dm->depth++;
+	dm->seq = dc->ndirmeta++;
+	dm->meta = *m;
+
+	return 0;
+}
+
+
+/* apply the metadata held back by tar_dir_defer() */
+int
+tar_dir_finish(TAR *t)
+{
+	struct tar_dircache *dc = t->dircache;
+	char base[MAXPATHLEN];
+	size_t i;
+	int dirfd, rv = 0, err = 0;
+
+	if (dc == NULL || dc->ndirmeta == 0)
+		return 0;
+
+	/* children go first, as creating them changes the parent's mtime */
+	qsort(dc->dirmeta, dc->ndirmeta, sizeof(struct tar_dirmeta),
+	      dirmeta_cmp);
+	for (i = 0; i < dc->ndirmeta; i++)
+	{
+		dirfd = tar_dir_parent(t, dc->dirmeta[i].path, base,
+				       sizeof(base));
+		if (dirfd == -1
+		    || tar_apply_meta(dirfd, base, &(dc->dirmeta[i].meta)) == -1)
+		{
+			if (rv == 0)
+				err = errno;
+			rv = -1;
+		}
+		free(dc->dirmeta[i].path);
+	}
+	dc->ndirmeta = 0;
+
+	if (rv == -1)
+		errno = err;
+	return rv;
+}
+
+
+/* set the root extracted paths must stay beneath */
+int
+tar_dir_root(TAR *t, const char *root)
+{
+	struct tar_dircache *dc;
+	char buf[MAXPATHLEN];
+	size_t len;
+
+	dc = dircache_get(t);
+	if (dc == NULL)
+		return -1;
+
+	/* left over from an extraction that failed part way */
+	tar_dir_finish(t);
+
+	/* the working directory or the root may be different this time */
+	dircache_flush(dc);
+	if (dc->rootfd != AT_FDCWD)
+		close(dc->rootfd);
+	dc->rootfd = AT_FDCWD;
+	free(dc->root);
+	dc->root = NULL;
+
+	if (root == NULL || !(t->options & TAR_RESOLVE_BENEATH))
+		return 0;
+
+	/* the root itself is trusted */
+	len = strlcpy(buf, root, sizeof(buf));
+	if (len >= sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (mkdirhier(buf) == -1)
+		return -1;
+	dc->rootfd = open(root, DIR_OFLAGS);
+	if (dc->rootfd == -1)
+	{
+		dc->rootfd = AT_FDCWD;
+		return -1;
+	}
+	dc->root = strdup(root);
+	if (dc->root == NULL)
+		return -1;
+	dc->rootlen = strlen(root);
+	while (dc->rootlen > 1 && dc->root[dc->rootlen - 1] == '/')
+		dc->rootlen--;
+
+	return 0;
+}
+
+
+/* look up the parent directory of an entry */
+int
+tar_dir_parent(TAR *t, const char *path, char *base, size_t basesize)
+{
+	struct tar_dircache *dc;
+	char buf[MAXPATHLEN];
+	char *slash;
+	size_t len, plen;
+
+	dc = dircache_get(t);
+	if (dc == NULL)
+		return -1;
+
+	if (t->options & TAR_RESOLVE_BENEATH)
+	{
+		if (dc->root != NULL)
+		{
+			if (strncmp(path, dc->root, dc->rootlen) != 0
+			    || path[dc->rootlen] != '/')
+			{
+				errno = EXDEV;
+				return -1;
+			}
+			for (path += dc->rootlen; *path == '/'; path++)
+				;
+		}
+		if (dircache_check(path) == -1)
+		{
+			errno = EXDEV;
+			return -1;
+		}
+	}
+
+	len = strlcpy(buf, path, sizeof(buf));
+	if (len >= sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	while (len > 1 && buf[len - 1] == '/')
+		buf[--len] = '\0';
+
+	slash = strrchr(buf, '/');
+	if (slash == NULL)
+	{
+		strlcpy(base, buf, basesize);
+		return dc->rootfd;
+	}
+
+	strlcpy(base, slash + 1, basesize);
+	plen = (slash == buf ? 1 : (size_t)(slash - buf));
+	while (plen > 1 && buf[plen - 1] == '/')
+		plen--;
+
+	/* the caller may have changed directory since the last entry */
+	if (dc->rootfd == AT_FDCWD && buf[0] != '/' && dircache_cwd(dc) == -1)
+		return -1;
+
+	return dircache_lookup(t, dc, buf, plen);
+}
+
+
+/* apply any pending directory metadata and close all cached directories */
+int
+tar_dir_close(TAR *t)
+{
+	int rv, err;
+
+	if (t->dircache == NULL)
+		return 0;
+
+	rv = tar_dir_finish(t);
+	err = errno;
+	dircache_flush(t->dircache);
+	if (t->dircache->rootfd != AT_FDCWD)
+		close(t->dircache->rootfd);
+	free(t->dircache->root);
+	free(t->dircache->dirmeta);
+	free(t->dircache);
+	t->dircache = NULL;
+
+	errno = err;
+	return rv;
+}
@@ -13,8 +13,6 @@
 #include <internal.h>
 
 #include <stdio.h>
-#include <pwd.h>
-#include <grp.h>
 #include <sys/types.h>
 
 #ifdef STDC_HEADERS
@@ -77,17 +75,20 @@ th_set_path(TAR *t, const char *pathname)
 	printf("in th_set_path(th, pathname=\"%s\")\n", pathname);
 #endif
 
-	if (t->th_buf.gnu_longname != NULL)
-		free(t->th_buf.gnu_longname);
 	t->th_buf.gnu_longname = NULL;
 
-	if (pathname[strlen(pathname) - 1] != '/' && TH_ISDIR(t))
+	if (pathname[strlen(pathname) - 1] != '/'
+	    && t->th_buf.typeflag == DIRTYPE)
 		strcpy(suffix, "/");
 
 	if (strlen(pathname) > T_NAMELEN-1 && (t->options & TAR_GNU))
 	{
 		/* GNU-style long name */
-		t->th_buf.gnu_longname = strdup(pathname);
+		t->th_buf.gnu_longname = tar_scratch(t, TAR_SCRATCH_LONGNAME,
+						     strlen(pathname) + 1);
+		if (t->th_buf.gnu_longname == NULL)
+			return;
+		strcpy(t->th_buf.gnu_longname, pathname);
 		strncpy(t->th_buf.name, t->th_buf.gnu_longname, T_NAMELEN);
 	}
 	else if (strlen(pathname) > T_NAMELEN)
@@ -125,7 +126,11 @@ th_set_link(TAR *t, const char *linkname)
 	if (strlen(linkname) > T_NAMELEN-1 && (t->options & TAR_GNU))
 	{
 		/* GNU longlink format */
-		t->th_buf.gnu_longlink = strdup(linkname);
+		t->th_buf.gnu_longlink = tar_scratch(t, TAR_SCRATCH_LONGLINK,
+						     strlen(linkname) + 1);
+		if (t->th_buf.gnu_longlink == NULL)
+			return;
+		strcpy(t->th_buf.gnu_longlink, linkname);
 		strcpy(t->th_buf.linkname, "././@LongLink");
 	}
 	else
@@ -133,8 +138,6 @@ th_set_link(TAR *t, const char *linkname)
 		/* classic tar format */
 		strlcpy(t->th_buf.linkname, linkname,
 			sizeof(t->th_buf.linkname));
-		if (t->th_buf.gnu_longlink != NULL)
-			free(t->th_buf.gnu_longlink);
 		t->th_buf.gnu_longlink = NULL;
 	}
 }
@@ -157,11 +160,11 @@ th_set_device(TAR *t, dev_t device)
 void
 th_set_user(TAR *t, uid_t uid)
 {
-	struct passwd *pw;
+	const char *name;
 
-	pw = getpwuid(uid);
-	if (pw != NULL)
-		strlcpy(t->th_buf.uname, pw->pw_name, sizeof(t->th_buf.uname));
+	name = ((t->options & TAR_NUMERIC_OWNER) ? NULL : tar_id_uname(t, uid));
+	if (name != NULL)
+		strlcpy(t->th_buf.uname, name, sizeof(t->th_buf.uname));
 
 	int_to_oct(uid, t->th_buf.uid, 8);
 }
@@ -171,11 +174,11 @@ th_set_user(TAR *t, uid_t uid)
 void
 th_set_group(TAR *t, gid_t gid)
 {
-	struct group *gr;
+	const char *name;
 
-	gr = getgrgid(gid);
-	if (gr != NULL)
-		strlcpy(t->th_buf.gname, gr->gr_name, sizeof(t->th_buf.gname));
+	name = ((t->options & TAR_NUMERIC_OWNER) ? NULL : tar_id_gname(t, gid));
+	if (name != NULL)
+		strlcpy(t->th_buf.gname, name, sizeof(t->th_buf.gname));
 
 	int_to_oct(gid, t->th_buf.gid, 8);
 }
@@ -18,7 +18,6 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <utime.h>
 
 #ifdef STDC_HEADERS
 # include <stdlib.h>
@@ -29,55 +28,88 @@
 #endif
 
 
-static int
-tar_set_file_perms(TAR *t, char *realname)
+/* decode the metadata to apply to an extracted file */
+void
+th_get_meta(TAR *t, struct tar_meta *m)
 {
-	mode_t mode;
-	uid_t uid;
-	gid_t gid;
-	struct utimbuf ut;
-	char *filename;
+	m->mode = th_get_mode(t);
+	m->chown = (t->euid == 0);
+
+	/* the owner is only looked up if it's going to be set */
+	m->uid = (m->chown ? th_get_uid(t) : (uid_t)-1);
+	m->gid = (m->chown ? th_get_gid(t) : (gid_t)-1);
+	m->times[0].tv_sec = th_get_atime(t);
+	m->times[0].tv_nsec = th_get_atime_nsec(t);
+	m->times[1].tv_sec = th_get_mtime(t);
+	m->times[1].tv_nsec = th_get_mtime_nsec(t);
+	m->issym = TH_ISSYM(t);
+}
 
-	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
-	ut.modtime = ut.actime = th_get_mtime(t);
 
+/* apply metadata from th_get_meta() to an extracted file */
+int
+tar_apply_meta(int dirfd, const char *name, const struct tar_meta *m)
+{
 	/* change owner/group */
-	if (geteuid() == 0)
-#ifdef HAVE_LCHOWN
-		if (lchown(filename, uid, gid) == -1)
-		{
-# ifdef DEBUG
-			fprintf(stderr, "lchown(\"%s\", %d, %d): %s\n",
-				filename, uid, gid, strerror(errno));
-# endif
-#else /* ! HAVE_LCHOWN */
-		if (!TH_ISSYM(t) && chown(filename, uid, gid) == -1)
-		{
-# ifdef DEBUG
-			fprintf(stderr, "chown(\"%s\", %d, %d): %s\n",
-				filename, uid, gid, strerror(errno));
-# endif
-#endif /* HAVE_LCHOWN */
-			return -1;
-		}
+	if (m->chown
+	    && fchownat(dirfd, name, m->uid, m->gid, AT_SYMLINK_NOFOLLOW) == -1)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "fchownat(\"%s\", %d, %d): %s\n",
+			name, m->uid, m->gid, strerror(errno));
+#endif
+		return -1;
+	}
 
 	/* change access/modification time */
-	if (!TH_ISSYM(t) && utime(filename, &ut) == -1)
+	if (!m->issym && utimensat(dirfd, name, m->times, 0) == -1)
+	{
+#ifdef DEBUG
+		perror("utimensat()");
+#endif
+		return -1;
+	}
+
+	/* change permissions */
+	if (!m->issym && fchmodat(dirfd, name, m->mode, 0) == -1)
 	{
 #ifdef DEBUG
-		perror("utime()");
+		perror("fchmodat()");
+#endif
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* apply metadata from th_get_meta() to a file that's still open */
+int
+tar_apply_fmeta(int fd, const struct tar_meta *m)
+{
+	/* change owner/group; before the mode, as it may clear setuid */
+	if (m->chown && fchown(fd, m->uid, m->gid) == -1)
+	{
+#ifdef DEBUG
+		perror("fchown()");
 #endif
 		return -1;
 	}
 
 	/* change permissions */
-	if (!TH_ISSYM(t) && chmod(filename, mode) == -1)
+	if (fchmod(fd, m->mode) == -1)
 	{
 #ifdef DEBUG
-		perror("chmod()");
+		perror("fchmod()");
+#endif
+		return -1;
+	}
+
+	/* change access/modification time, now that all data is written */
+	if (futimens(fd, m->times) == -1)
+	{
+#ifdef DEBUG
+		perror("futimens()");
 #endif
 		return -1;
 	}
@@ -86,14 +118,125 @@ tar_set_file_perms(TAR *t, char *realname)
 }
 
 
+static int
+tar_set_file_perms(TAR *t, char *realname)
+{
+	struct tar_meta m;
+	char base[MAXPATHLEN];
+	int dirfd;
+
+	dirfd = tar_dir_parent(t, (realname ? realname : th_get_pathname(t)),
+			       base, sizeof(base));
+	if (dirfd == -1)
+		return -1;
+
+	th_get_meta(t, &m);
+	return tar_apply_meta(dirfd, base, &m);
+}
+
+
+void
+tar_set_samefunc(TAR *t, tar_samefunc_t func, void *arg)
+{
+	t->samefunc = func;
+	t->samearg = arg;
+}
+
+
+/* leave a file that's already up to date alone */
+int
+tar_extract_unchanged(TAR *t, int dirfd, const char *name, char *realname,
+		      const struct tar_meta *m)
+{
+	libtar_hashptr_t hp;
+	struct stat s;
+
+	if (!(t->options & TAR_SKIP_UNCHANGED))
+		return 0;
+
+	/*
+	** an entry that's in the archive twice is always rewritten, as what's
+	** on disk may not be the earlier copy yet (tar_extract_all_parallel())
+	*/
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(t->h, &hp, th_get_pathname(t),
+			       (libtar_matchfunc_t)libtar_str_match) != 0)
+		return 0;
+
+	if (fstatat(dirfd, name, &s, AT_SYMLINK_NOFOLLOW) == -1)
+		return (errno == ENOENT ? 0 : -1);
+	if (!S_ISREG(s.st_mode)
+	    || s.st_size != th_get_realsize(t)
+	    || (s.st_mode & 07777) != (m->mode & 07777)
+	    || (m->chown && (s.st_uid != m->uid || s.st_gid != m->gid)))
+		return 0;
+
+	/* a file system without sub-second times has dropped them */
+	if (compat_st_mtim(&s).tv_sec != m->times[1].tv_sec
+	    || (compat_st_mtim(&s).tv_nsec != m->times[1].tv_nsec
+		&& compat_st_mtim(&s).tv_nsec != 0))
+		return 0;
+
+	if (t->samefunc != NULL && !(*(t->samefunc))(realname, &s, t->samearg))
+		return 0;
+
+#ifdef DEBUG
+	printf("    tar_extract_unchanged(): skipping %s\n", realname);
+#endif
+	if (tar_skip_regfile(t) == -1)
+		return -1;
+	return 1;
+}
+
+
+/* remember where the current entry went, for hardlinks to it */
+int
+tar_extract_remember(TAR *t, char *realname)
+{
+	char *lnp;
+	size_t pathname_len;
+	size_t realname_len;
+
+	/* the pair lives as long as the handle, so it goes in the arena */
+	pathname_len = strlen(th_get_pathname(t)) + 1;
+	realname_len = strlen(realname) + 1;
+	lnp = (char *)tar_arena_alloc(t, pathname_len + realname_len);
+	if (lnp == NULL)
+		return -1;
+	memcpy(&lnp[0], th_get_pathname(t), pathname_len);
+	memcpy(&lnp[pathname_len], realname, realname_len);
+#ifdef DEBUG
+	printf("tar_extract_remember(): calling libtar_hash_add(): key=\"%s\", "
+	       "value=\"%s\"\n", th_get_pathname(t), realname);
+#endif
+	return libtar_hash_add(t->h, lnp);
+}
+
+
+/* map a hardlink target to the name it was extracted as */
+char *
+tar_extract_linktarget(TAR *t, char *linkname)
+{
+	libtar_hashptr_t hp;
+	char *lnp;
+
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(t->h, &hp, linkname,
+			       (libtar_matchfunc_t)libtar_str_match) != 0)
+	{
+		lnp = (char *)libtar_hashptr_data(&hp);
+		return &lnp[strlen(lnp) + 1];
+	}
+
+	return linkname;
+}
+
+
 /* switchboard */
 int
 tar_extract_file(TAR *t, char *realname)
 {
-	int i;
-	char *lnp;
-	int pathname_len;
-	int realname_len;
+	int i, done = 0;
 
 	if (t->options & TAR_NOOVERWRITE)
 	{
@@ -106,11 +249,13 @@ tar_extract_file(TAR *t, char *realname)
 		}
 	}
 
+	/* these two set the metadata themselves */
 	if (TH_ISDIR(t))
 	{
 		i = tar_extract_dir(t, realname);
 		if (i == 1)
 			i = 0;
+		done = 1;
 	}
 	else if (TH_ISLNK(t))
 		i = tar_extract_hardlink(t, realname);
@@ -123,30 +268,257 @@ tar_extract_file(TAR *t, char *realname)
 	else if (TH_ISFIFO(t))
 		i = tar_extract_fifo(t, realname);
 	else /* if (TH_ISREG(t)) */
+	{
 		i = tar_extract_regfile(t, realname);
+		done = 1;
+	}
 
 	if (i != 0)
 		return i;
 
-	i = tar_set_file_perms(t, realname);
-	if (i != 0)
-		return i;
+	if (!done)
+	{
+		i = tar_set_file_perms(t, realname);
+		if (i != 0)
+			return i;
+	}
 
-	pathname_len = strlen(th_get_pathname(t)) + 1;
-	realname_len = strlen(realname) + 1;
-	lnp = (char *)calloc(1, pathname_len + realname_len);
-	if (lnp == NULL)
+	return tar_extract_remember(t, realname);
+}
+
+
+/*
+** write the data runs of a sparse file to their offsets; whatever isn't
+** written stays a hole in the newly created file
+*/
+static int
+tar_extract_sparse(TAR *t, int fdout)
+{
+	struct tar_sparse *sp = t->th_buf.sparse;
+	struct tar_sparse *end = sp + t->th_buf.nsparse;
+	off_t size, done = 0;
+	size_t len, n;
+	ssize_t k;
+	char *buf;
+
+	for (size = th_get_size(t); size > 0; size -= len)
+	{
+		k = tar_block_next(t, size, &buf);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		len = ((off_t)k > size ? (size_t)size : (size_t)k);
+		t->cursor.left -= len;
+
+		/* the runs are stored back to back, so one block may span several */
+		for (n = 0; n < len; )
+		{
+			k = len - n;
+			while (sp < end && sp->numbytes == done)
+			{
+				sp++;
+				done = 0;
+			}
+			if (sp == end)
+			{
+				errno = EINVAL;
+				return -1;
+			}
+			if ((off_t)k > sp->numbytes - done)
+				k = (ssize_t)(sp->numbytes - done);
+
+			k = pwrite(fdout, buf + n, k, sp->offset + done);
+			if (k == -1)
+				return -1;
+			n += k;
+			done += k;
+		}
+	}
+
+	/* a trailing hole only shows up in the file size */
+	return ftruncate(fdout, th_get_realsize(t));
+}
+
+
+/*
+** reserve disk space for len bytes at offset in fd without changing the
+** file size; only running out of space counts as an error, as many file
+** systems can't do this
+*/
+int
+tar_preallocate(int fd, off_t offset, off_t len)
+{
+#if defined(__linux__)
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+		return 0;
+#elif defined(F_PREALLOCATE)
+	fstore_t fst;
+
+	/* macOS allocates after the current end of the file only */
+	if (offset != 0)
+		return 0;
+	fst.fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL;
+	fst.fst_posmode = F_PEOFPOSMODE;
+	fst.fst_offset = 0;
+	fst.fst_length = len;
+	if (fcntl(fd, F_PREALLOCATE, &fst) == 0)
+		return 0;
+
+	/* settle for space that isn't contiguous */
+	fst.fst_flags = F_ALLOCATEALL;
+	if (fcntl(fd, F_PREALLOCATE, &fst) == 0)
+		return 0;
+#else
+	return 0;
+#endif
+
+	if (errno == ENOSPC
+#ifdef EDQUOT
+	    || errno == EDQUOT
+#endif
+	   )
 		return -1;
-	strcpy(&lnp[0], th_get_pathname(t));
-	strcpy(&lnp[pathname_len], realname);
-#ifdef DEBUG
-	printf("tar_extract_file(): calling libtar_hash_add(): key=\"%s\", "
-	       "value=\"%s\"\n", th_get_pathname(t), realname);
+	return 0;
+}
+
+
+/* reserve space for the data of the current regfile (TAR_PREALLOCATE) */
+static int
+tar_extract_preallocate(TAR *t, int fdout)
+{
+	int i;
+
+	/* just the data runs of a sparse file, so the holes stay holes */
+	if (TH_ISSPARSE(t))
+	{
+		for (i = 0; i < t->th_buf.nsparse; i++)
+			if (t->th_buf.sparse[i].numbytes > 0
+			    && tar_preallocate(fdout, t->th_buf.sparse[i].offset,
+					       t->th_buf.sparse[i].numbytes) == -1)
+				return -1;
+		return 0;
+	}
+
+	if (th_get_size(t) == 0)
+		return 0;
+	return tar_preallocate(fdout, 0, th_get_size(t));
+}
+
+
+#ifdef __linux__
+/* don't bother the kernel for less than this */
+# define KCOPY_MIN		(64 * 1024)
+
+/* values for the TAR nokcopy field */
+# define KCOPY_NO_RANGE		1	/* copy_file_range() */
+# define KCOPY_NO_SPLICE	2	/* splice() */
+
+/*
+** move size bytes of file data, and the padding after them, from the
+** archive descriptor to fdout without passing through user space:
+** copy_file_range() for a regular archive (a reflink on file systems
+** that share extents), splice() for a pipe; the read-ahead buffer must
+** be empty
+** returns 1 if the data was moved, 0 if the kernel can't do it here (and
+** nothing was consumed), or -1 (and sets errno) on error
+*/
+static int
+tar_extract_kcopy(TAR *t, int fdout, off_t size)
+{
+	char pad[T_BLOCKSIZE];
+	off_t done = 0;
+	size_t len;
+	ssize_t k;
+
+	while (done < size)
+	{
+		len = (size - done > (off_t)(1 << 30)
+		       ? (size_t)(1 << 30) : (size_t)(size - done));
+
+		k = -1;
+		if (!(t->nokcopy & KCOPY_NO_RANGE))
+		{
+			k = copy_file_range(t->fd, NULL, fdout, NULL, len, 0);
+			if (k == -1 && done == 0 && errno != EINTR
+			    && errno != EIO && errno != ENOSPC)
+				t->nokcopy |= KCOPY_NO_RANGE;
+		}
+		if (k == -1 && (t->nokcopy & KCOPY_NO_RANGE)
+		    && !(t->nokcopy & KCOPY_NO_SPLICE))
+		{
+			k = splice(t->fd, NULL, fdout, NULL, len, 0);
+			if (k == -1 && done == 0 && errno != EINTR
+			    && errno != EIO && errno != ENOSPC)
+				t->nokcopy |= KCOPY_NO_SPLICE;
+		}
+
+		if (k == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (done == 0 && (t->nokcopy & KCOPY_NO_SPLICE))
+				return 0;
+			return -1;
+		}
+		if (k == 0)
+		{
+			/* truncated archive */
+			errno = EINVAL;
+			return -1;
+		}
+		done += k;
+	}
+	t->offset += size;
+
+	/* the descriptor now sits in the middle of a block */
+	for (len = (size_t)(-size & (T_BLOCKSIZE - 1)); len > 0; len -= k)
+	{
+		k = (*(t->type->readfunc))(t->fd, pad, len);
+		if (k <= 0)
+		{
+			if (k == 0)
+				errno = EINVAL;
+			return -1;
+		}
+		t->offset += k;
+	}
+
+	return 1;
+}
+#endif /* __linux__ */
+
+
+/* create (or truncate) a regfile to extract into */
+int
+tar_extract_open(TAR *t, int dirfd, const char *base)
+{
+	int fd, oflags;
+
+	oflags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_BINARY
+	oflags |= O_BINARY;
 #endif
-	if (libtar_hash_add(t->h, lnp) != 0)
+	if (t->options & TAR_RESOLVE_BENEATH)
+		oflags |= O_NOFOLLOW;
+
+	/* the old file may be linked to by other names since TAR_DEDUP */
+	if ((t->options & TAR_DEDUP_HARDLINK)
+	    && unlinkat(dirfd, base, 0) == -1 && errno != ENOENT)
 		return -1;
 
-	return 0;
+	fd = openat(dirfd, base, oflags, 0666);
+	if (fd == -1 && errno == ELOOP
+	    && (t->options & TAR_RESOLVE_BENEATH))
+	{
+		/* replace a symlink rather than write through it */
+		if (unlinkat(dirfd, base, 0) == 0)
+			fd = openat(dirfd, base, oflags, 0666);
+	}
+
+	return fd;
 }
 
 
@@ -154,14 +526,15 @@ tar_extract_file(TAR *t, char *realname)
 int
 tar_extract_regfile(TAR *t, char *realname)
 {
-	mode_t mode;
-	size_t size;
-	uid_t uid;
-	gid_t gid;
-	int fdout;
-	int i, k;
-	char buf[T_BLOCKSIZE];
+	struct tar_meta m;
+	uint64_t hash = TAR_DEDUP_SEED;
+	off_t size;
+	size_t len, pending = 0;
+	int dirfd, fdout, i;
+	ssize_t k;
+	char *buf;
 	char *filename;
+	char base[MAXPATHLEN];
 
 #ifdef DEBUG
 	printf("==> tar_extract_regfile(t=0x%lx, realname=\"%s\")\n", t,
@@ -175,23 +548,62 @@ tar_extract_regfile(TAR *t, char *realname)
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
+	th_get_meta(t, &m);
 	size = th_get_size(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
+	if (size < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
 
-	if (mkdirhier(dirname(filename)) == -1)
+	/* tar_entry_read() has already taken part of it */
+	if (t->cursor.left != size || t->cursor.pos != 0)
+	{
+		errno = EINVAL;
 		return -1;
+	}
+
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1)
+		return -1;
+
+	i = tar_extract_unchanged(t, dirfd, base, filename, &m);
+	if (i != 0)
+		return (i == 1 ? 0 : -1);
+
+	/* a payload that's in memory in full may not need writing at all */
+	if ((t->options & TAR_DEDUP) && !TH_ISSPARSE(t) && size > 0)
+	{
+		k = tar_block_next(t, size, &buf);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		pending = ((off_t)k > size ? (size_t)size : (size_t)k);
+		t->cursor.left -= pending;
+		hash = tar_dedup_hash(hash, buf, pending);
+		if ((off_t)pending == size)
+		{
+			i = tar_dedup_extract(t, hash, buf, size, filename, &m);
+			if (i == 1)
+				tar_cursor_end(t);
+			if (i != 0)
+				return (i == 1 ? 0 : -1);
+		}
+
+		/* looking for the copy may have evicted the directory */
+		dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+		if (dirfd == -1)
+			return -1;
+	}
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (mode %04o, uid %d, gid %d, %d bytes)\n",
-	       filename, mode, uid, gid, size);
-#endif
-	fdout = open(filename, O_WRONLY | O_CREAT | O_TRUNC
-#ifdef O_BINARY
-		     | O_BINARY
+	       filename, m.mode, m.uid, m.gid, size);
 #endif
-		    , 0666);
+	fdout = tar_extract_open(t, dirfd, base);
 	if (fdout == -1)
 	{
 #ifdef DEBUG
@@ -200,41 +612,92 @@ tar_extract_regfile(TAR *t, char *realname)
 		return -1;
 	}
 
-#if 0
-	/* change the owner.  (will only work if run as root) */
-	if (fchown(fdout, uid, gid) == -1 && errno != EPERM)
+	/* fail now rather than half way through a file that can't fit */
+	if ((t->options & TAR_PREALLOCATE)
+	    && tar_extract_preallocate(t, fdout) == -1)
 	{
-#ifdef DEBUG
-		perror("fchown()");
-#endif
+		close(fdout);
 		return -1;
 	}
 
-	/* make sure the mode isn't inheritted from a file we're overwriting */
-	if (fchmod(fdout, mode & 07777) == -1)
+	if (TH_ISSPARSE(t))
 	{
-#ifdef DEBUG
-		perror("fchmod()");
-#endif
-		return -1;
+		if (tar_extract_sparse(t, fdout) != 0)
+		{
+			close(fdout);
+			return -1;
+		}
+		size = 0;
 	}
-#endif
 
-	/* extract the file */
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
+	/* extract the file, as many buffered blocks at a time as possible */
+	while (size > 0)
 	{
-		k = tar_block_read(t, buf);
-		if (k != T_BLOCKSIZE)
+		if (pending > 0)
 		{
-			if (k != -1)
-				errno = EINVAL;
-			return -1;
+			/* taken out of the buffer for TAR_DEDUP already */
+			len = pending;
+			pending = 0;
 		}
+		else
+		{
+#ifdef __linux__
+			/* with the buffer drained, let the kernel move the rest */
+			if (size >= KCOPY_MIN && t->rbufpos == t->rbuflen
+			    && t->map == NULL && t->type->readfunc == read
+			    && !(t->options & TAR_DEDUP)
+			    && (t->nokcopy & (KCOPY_NO_RANGE | KCOPY_NO_SPLICE))
+			       != (KCOPY_NO_RANGE | KCOPY_NO_SPLICE))
+			{
+				i = tar_extract_kcopy(t, fdout, size);
+				if (i == -1)
+				{
+					close(fdout);
+					return -1;
+				}
+				if (i == 1)
+				{
+					t->cursor.left = 0;
+					break;
+				}
+			}
+#endif
 
-		/* write block to output file */
-		if (write(fdout, buf,
-			  ((i > T_BLOCKSIZE) ? T_BLOCKSIZE : i)) == -1)
-			return -1;
+			k = tar_block_next(t, size, &buf);
+			if (k <= 0)
+			{
+				if (k != -1)
+					errno = EINVAL;
+				close(fdout);
+				return -1;
+			}
+			len = ((off_t)k > size ? (size_t)size : (size_t)k);
+			t->cursor.left -= len;
+			if (t->options & TAR_DEDUP)
+				hash = tar_dedup_hash(hash, buf, len);
+		}
+
+		/* write blocks to output file; a short write means ENOSPC next */
+		size -= len;
+		while (len > 0)
+		{
+			k = write(fdout, buf, len);
+			if (k == -1)
+			{
+				close(fdout);
+				return -1;
+			}
+			buf += k;
+			len -= k;
+		}
+	}
+	tar_cursor_end(t);
+
+	/* set owner, mode and times while the file is still open */
+	if (tar_apply_fmeta(fdout, &m) == -1)
+	{
+		close(fdout);
+		return -1;
 	}
 
 	/* close output file */
@@ -245,6 +708,12 @@ tar_extract_regfile(TAR *t, char *realname)
 	printf("### done extracting %s\n", filename);
 #endif
 
+	/* later copies of the payload can be made from this file */
+	if ((t->options & TAR_DEDUP) && !TH_ISSPARSE(t)
+	    && th_get_size(t) > 0
+	    && tar_dedup_add(t, hash, th_get_size(t), filename, &m) == -1)
+		return -1;
+
 	return 0;
 }
 
@@ -253,9 +722,7 @@ tar_extract_regfile(TAR *t, char *realname)
 int
 tar_skip_regfile(TAR *t)
 {
-	int i, k;
-	size_t size;
-	char buf[T_BLOCKSIZE];
+	off_t size;
 
 	if (!TH_ISREG(t))
 	{
@@ -263,70 +730,168 @@ tar_skip_regfile(TAR *t)
 		return -1;
 	}
 
-	size = th_get_size(t);
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
+	if (th_get_size(t) < 0)
 	{
-		k = tar_block_read(t, buf);
-		if (k != T_BLOCKSIZE)
-		{
-			if (k != -1)
-				errno = EINVAL;
-			return -1;
-		}
+		errno = EINVAL;
+		return -1;
 	}
 
-	return 0;
+	/* what tar_entry_read() has buffered is already consumed */
+	size = t->cursor.left;
+	size = (size + T_BLOCKSIZE - 1) & ~((off_t)T_BLOCKSIZE - 1);
+	tar_cursor_end(t);
+
+	return tar_block_skip(t, size);
 }
 
 
-/* hardlink */
+/* map regfile */
 int
-tar_extract_hardlink(TAR * t, char *realname)
+tar_regfile_data(TAR *t, const char **data, size_t *size)
 {
-	char *filename;
-	char *linktgt = NULL;
-	char *lnp;
-	libtar_hashptr_t hp;
+	ssize_t k;
+	char *buf;
 
-	if (!TH_ISLNK(t))
+	if (t->map == NULL || !TH_ISREG(t) || TH_ISSPARSE(t))
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	filename = (realname ? realname : th_get_pathname(t));
-	if (mkdirhier(dirname(filename)) == -1)
+	if ((off_t)(size_t)th_get_size(t) != th_get_size(t))
+	{
+		errno = EFBIG;
 		return -1;
-	libtar_hashptr_reset(&hp);
-	if (libtar_hash_getkey(t->h, &hp, th_get_linkname(t),
-			       (libtar_matchfunc_t)libtar_str_match) != 0)
+	}
+	*size = (size_t)th_get_size(t);
+	if (*size == 0)
 	{
-		lnp = (char *)libtar_hashptr_data(&hp);
-		linktgt = &lnp[strlen(lnp) + 1];
+		*data = t->rbuf + t->rbufpos;
+		return 0;
+	}
+
+	k = tar_block_next(t, *size, &buf);
+	if (k < 0)
+		return -1;
+	if ((size_t)k < *size)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	*data = buf;
+	tar_cursor_end(t);
+
+	return 0;
+}
+
+
+/*
+** TAR_SKIP_UNCHANGED extracts over what an earlier run left behind, so
+** remove the old node before one is created in its place
+*/
+static int
+tar_extract_clear(TAR *t, int dirfd, const char *base)
+{
+	if ((t->options & TAR_SKIP_UNCHANGED)
+	    && unlinkat(dirfd, base, 0) == -1 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+
+/*
+** create filename as a hardlink to the entry extracted for linkname, and
+** give it the metadata in m unless that's NULL
+*/
+int
+tar_extract_linkto(TAR *t, char *linkname, char *filename,
+		   const struct tar_meta *m)
+{
+	char *linktgt;
+	char base[MAXPATHLEN];
+	char tbase[MAXPATHLEN];
+	struct stat s, ts;
+	int dirfd, tdirfd = AT_FDCWD;
+	int i;
+
+	linktgt = tar_extract_linktarget(t, linkname);
+
+	/* the target must stay beneath the root too */
+	if (t->options & TAR_RESOLVE_BENEATH)
+	{
+		tdirfd = tar_dir_parent(t, linktgt, tbase, sizeof(tbase));
+		if (tdirfd == -1)
+			return -1;
+		tdirfd = dup(tdirfd);
+		if (tdirfd == -1)
+			return -1;
+		linktgt = tbase;
+	}
+
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1)
+	{
+		if (tdirfd != AT_FDCWD)
+			close(tdirfd);
+		return -1;
+	}
+
+	/* a link that's still in place is left alone */
+	i = 0;
+	if ((t->options & TAR_SKIP_UNCHANGED)
+	    && fstatat(dirfd, base, &s, AT_SYMLINK_NOFOLLOW) == 0)
+	{
+		if (fstatat(tdirfd, linktgt, &ts, AT_SYMLINK_NOFOLLOW) == 0
+		    && s.st_dev == ts.st_dev && s.st_ino == ts.st_ino)
+			i = 1;
+		else if (unlinkat(dirfd, base, 0) == -1)
+			i = -1;
 	}
-	else
-		linktgt = th_get_linkname(t);
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (link to %s)\n", filename, linktgt);
 #endif
-	if (link(linktgt, filename) == -1)
+	if (i == 0)
+		i = linkat(tdirfd, linktgt, dirfd, base, 0);
+	if (tdirfd != AT_FDCWD)
+		close(tdirfd);
+	if (i == -1)
 	{
 #ifdef DEBUG
-		perror("link()");
+		perror("linkat()");
 #endif
 		return -1;
 	}
 
+	if (m != NULL)
+		return tar_apply_meta(dirfd, base, m);
 	return 0;
 }
 
 
+/* hardlink */
+int
+tar_extract_hardlink(TAR * t, char *realname)
+{
+	if (!TH_ISLNK(t))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	return tar_extract_linkto(t, th_get_linkname(t),
+				  (realname ? realname : th_get_pathname(t)),
+				  NULL);
+}
+
+
 /* symlink */
 int
 tar_extract_symlink(TAR *t, char *realname)
 {
 	char *filename;
+	char base[MAXPATHLEN];
+	int dirfd;
 
 	if (!TH_ISSYM(t))
 	{
@@ -335,20 +900,21 @@ tar_extract_symlink(TAR *t, char *realname)
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
-	if (mkdirhier(dirname(filename)) == -1)
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1)
 		return -1;
 
-	if (unlink(filename) == -1 && errno != ENOENT)
+	if (unlinkat(dirfd, base, 0) == -1 && errno != ENOENT)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (symlink to %s)\n",
 	       filename, th_get_linkname(t));
 #endif
-	if (symlink(th_get_linkname(t), filename) == -1)
+	if (symlinkat(th_get_linkname(t), dirfd, base) == -1)
 	{
 #ifdef DEBUG
-		perror("symlink()");
+		perror("symlinkat()");
 #endif
 		return -1;
 	}
@@ -364,6 +930,8 @@ tar_extract_chardev(TAR *t, char *realname)
 	mode_t mode;
 	unsigned long devmaj, devmin;
 	char *filename;
+	char base[MAXPATHLEN];
+	int dirfd;
 
 	if (!TH_ISCHR(t))
 	{
@@ -376,18 +944,19 @@ tar_extract_chardev(TAR *t, char *realname)
 	devmaj = th_get_devmajor(t);
 	devmin = th_get_devminor(t);
 
-	if (mkdirhier(dirname(filename)) == -1)
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1 || tar_extract_clear(t, dirfd, base) == -1)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (character device %ld,%ld)\n",
 	       filename, devmaj, devmin);
 #endif
-	if (mknod(filename, mode | S_IFCHR,
+	if (mknodat(dirfd, base, mode | S_IFCHR,
 		  compat_makedev(devmaj, devmin)) == -1)
 	{
 #ifdef DEBUG
-		perror("mknod()");
+		perror("mknodat()");
 #endif
 		return -1;
 	}
@@ -403,6 +972,8 @@ tar_extract_blockdev(TAR *t, char *realname)
 	mode_t mode;
 	unsigned long devmaj, devmin;
 	char *filename;
+	char base[MAXPATHLEN];
+	int dirfd;
 
 	if (!TH_ISBLK(t))
 	{
@@ -415,18 +986,19 @@ tar_extract_blockdev(TAR *t, char *realname)
 	devmaj = th_get_devmajor(t);
 	devmin = th_get_devminor(t);
 
-	if (mkdirhier(dirname(filename)) == -1)
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1 || tar_extract_clear(t, dirfd, base) == -1)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (block device %ld,%ld)\n",
 	       filename, devmaj, devmin);
 #endif
-	if (mknod(filename, mode | S_IFBLK,
+	if (mknodat(dirfd, base, mode | S_IFBLK,
 		  compat_makedev(devmaj, devmin)) == -1)
 	{
 #ifdef DEBUG
-		perror("mknod()");
+		perror("mknodat()");
 #endif
 		return -1;
 	}
@@ -439,8 +1011,11 @@ tar_extract_blockdev(TAR *t, char *realname)
 int
 tar_extract_dir(TAR *t, char *realname)
 {
-	mode_t mode;
+	struct tar_meta m;
 	char *filename;
+	char base[MAXPATHLEN];
+	struct stat s;
+	int dirfd, i = 0;
 
 	if (!TH_ISDIR(t))
 	{
@@ -449,44 +1024,45 @@ tar_extract_dir(TAR *t, char *realname)
 	}
 
 	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
+	th_get_meta(t, &m);
 
-	if (mkdirhier(dirname(filename)) == -1)
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (mode %04o, directory)\n", filename,
-	       mode);
+	       m.mode);
 #endif
-	if (mkdir(filename, mode) == -1)
+	/* it has to stay writable until tar_dir_finish() sets the mode */
+	if (mkdirat(dirfd, base, S_IRWXU) == -1)
 	{
-		if (errno == EEXIST)
+		if (errno != EEXIST)
 		{
-			if (chmod(filename, mode) == -1)
-			{
 #ifdef DEBUG
-				perror("chmod()");
+			perror("mkdirat()");
 #endif
-				return -1;
-			}
-			else
-			{
-#ifdef DEBUG
-				puts("  *** using existing directory");
-#endif
-				return 1;
-			}
+			return -1;
 		}
-		else
+
+		/* don't let a symlink stand in for the directory */
+		if ((t->options & TAR_RESOLVE_BENEATH)
+		    && (fstatat(dirfd, base, &s, AT_SYMLINK_NOFOLLOW) == -1
+			|| !S_ISDIR(s.st_mode)))
 		{
-#ifdef DEBUG
-			perror("mkdir()");
-#endif
+			errno = EEXIST;
 			return -1;
 		}
+#ifdef DEBUG
+		puts("  *** using existing directory");
+#endif
+		i = 1;
 	}
 
-	return 0;
+	if (tar_dir_defer(t, filename, &m) == -1)
+		return -1;
+
+	return i;
 }
 
 
@@ -496,6 +1072,8 @@ tar_extract_fifo(TAR *t, char *realname)
 {
 	mode_t mode;
 	char *filename;
+	char base[MAXPATHLEN];
+	int dirfd;
 
 	if (!TH_ISFIFO(t))
 	{
@@ -506,16 +1084,17 @@ tar_extract_fifo(TAR *t, char *realname)
 	filename = (realname ? realname : th_get_pathname(t));
 	mode = th_get_mode(t);
 
-	if (mkdirhier(dirname(filename)) == -1)
+	dirfd = tar_dir_parent(t, filename, base, sizeof(base));
+	if (dirfd == -1 || tar_extract_clear(t, dirfd, base) == -1)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (fifo)\n", filename);
 #endif
-	if (mkfifo(filename, mode) == -1)
+	if (mkfifoat(dirfd, base, mode) == -1)
 	{
 #ifdef DEBUG
-		perror("mkfifo()");
+		perror("mkfifoat()");
 #endif
 		return -1;
 	}
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/mman.h>
 
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -27,7 +28,7 @@
 
 const char libtar_version[] = PACKAGE_VERSION;
 
-static tartype_t default_type = { open, close, read, write };
+static tartype_t default_type = { open, close, read, write, lseek };
 
 
 static int
@@ -48,12 +49,17 @@ tar_init(TAR **t, const char *pathname, tartype_t *type,
 	(*t)->options = options;
 	(*t)->type = (type ? type : &default_type);
 	(*t)->oflags = oflags;
+	(*t)->euid = geteuid();
+	if ((oflags & O_ACCMODE) == O_RDONLY)
+		(*t)->rbufsize = TAR_READBUF_DEFAULT;
+	else
+		(*t)->wbufsize = TAR_WRITEBUF_DEFAULT;
 
 	if ((oflags & O_ACCMODE) == O_RDONLY)
 		(*t)->h = libtar_hash_new(256,
 					  (libtar_hashfunc_t)path_hashfunc);
 	else
-		(*t)->h = libtar_hash_new(16, (libtar_hashfunc_t)dev_hash);
+		(*t)->h = libtar_hash_new(16, (libtar_hashfunc_t)tar_ino_hash);
 	if ((*t)->h == NULL)
 	{
 		free(*t);
@@ -102,6 +108,51 @@ tar_fdopen(TAR **t, int fd, const char *pathname, tartype_t *type,
 }
 
 
+int
+tar_mmap_open(TAR **t, const char *pathname, int options)
+{
+	struct stat s;
+
+	if (tar_open(t, pathname, NULL, O_RDONLY, 0, options) == -1)
+		return -1;
+
+	if (fstat((*t)->fd, &s) == -1)
+	{
+		tar_close(*t);
+		return -1;
+	}
+
+	/* an empty archive can't be mapped; plain reads will hit EOF */
+	if (s.st_size == 0)
+		return 0;
+
+	if ((off_t)(size_t)s.st_size != s.st_size)
+	{
+		tar_close(*t);
+		errno = EFBIG;
+		return -1;
+	}
+
+	(*t)->map = mmap(NULL, (size_t)s.st_size, PROT_READ, MAP_SHARED,
+			 (*t)->fd, 0);
+	if ((*t)->map == MAP_FAILED)
+	{
+		(*t)->map = NULL;
+		tar_close(*t);
+		return -1;
+	}
+	(*t)->mapsize = (size_t)s.st_size;
+
+	/* the mapping is the read-ahead buffer, already filled */
+	(*t)->rbuf = (char *)(*t)->map;
+	(*t)->rbufsize = (*t)->mapsize;
+	(*t)->rbuflen = (*t)->mapsize;
+	(*t)->rbufpos = 0;
+
+	return 0;
+}
+
+
 int
 tar_fd(TAR *t)
 {
@@ -109,34 +160,103 @@ tar_fd(TAR *t)
 }
 
 
+int
+tar_set_readbuf(TAR *t, size_t size)
+{
+	if (t->rbuf != NULL)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (size < T_BLOCKSIZE)
+		size = T_BLOCKSIZE;
+	t->rbufsize = (size + T_BLOCKSIZE - 1) & ~((size_t)T_BLOCKSIZE - 1);
+
+	return 0;
+}
+
+
+int
+tar_set_writebuf(TAR *t, size_t size)
+{
+	if (t->wbuf != NULL)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (size < T_BLOCKSIZE)
+		size = T_BLOCKSIZE;
+	t->wbufsize = (size + T_BLOCKSIZE - 1) & ~((size_t)T_BLOCKSIZE - 1);
+
+	return 0;
+}
+
+
+char *
+tar_scratch(TAR *t, int slot, size_t size)
+{
+	size_t newsize;
+	char *p;
+
+	if (size <= t->scratchsize[slot])
+		return t->scratch[slot];
+
+	/* grow geometrically so a run of growing names settles quickly */
+	newsize = (t->scratchsize[slot] ? t->scratchsize[slot] : 1024);
+	while (newsize < size)
+		newsize *= 2;
+
+	p = (char *)realloc(t->scratch[slot], newsize);
+	if (p == NULL)
+		return NULL;
+	t->scratch[slot] = p;
+	t->scratchsize[slot] = newsize;
+
+	return p;
+}
+
+
 /* close tarfile handle */
 int
 tar_close(TAR *t)
 {
-	int i;
+	int i, rv = 0;
 
-	i = (*(t->type->closefunc))(t->fd);
+	/* blocks still buffered are lost if they can't be written */
+	if (t->wbuflen > 0 && tar_flush(t) == -1)
+		rv = -1;
+	if ((*(t->type->closefunc))(t->fd) == -1)
+		rv = -1;
 
 	if (t->h != NULL)
-		libtar_hash_free(t->h, ((t->oflags & O_ACCMODE) == O_RDONLY
-					? free
-					: (libtar_freefunc_t)tar_dev_free));
-
-	/* free PAX extended header data */
-	if (t->th_buf.pax_path != NULL)
-		free(t->th_buf.pax_path);
-	if (t->th_buf.pax_linkpath != NULL)
-		free(t->th_buf.pax_linkpath);
-
-	/* free GNU long name/link data */
-	if (t->th_buf.gnu_longname != NULL)
-		free(t->th_buf.gnu_longname);
-	if (t->th_buf.gnu_longlink != NULL)
-		free(t->th_buf.gnu_longlink);
+		libtar_hash_free(t->h, NULL);
+	if (t->dedup != NULL)
+		libtar_hash_free(t->dedup, NULL);
+	if (t->ids != NULL)
+		libtar_hash_free(t->ids, NULL);
+
+	if (t->map != NULL)
+		munmap(t->map, t->mapsize);
+	else if (t->rbuf != NULL)
+		free(t->rbuf);
+	free(t->wbuf);
+
+	/* free GNU long name/link and PAX data */
+	for (i = 0; i < TAR_SCRATCH_MAX; i++)
+		free(t->scratch[i]);
+	for (i = 0; i < t->pax_ngdata; i++)
+		free(t->pax_gdata[i]);
+	free(t->pax_gdata);
+	free(t->pax_global.xattrs);
+	if (tar_dir_close(t) == -1)
+		rv = -1;
+	tar_arena_free(t);
 
 	free(t);
 
-	return i;
+	return rv;
 }
 
 
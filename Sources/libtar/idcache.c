@@ -0,0 +1,247 @@
+/*
+**  idcache.c - libtar code to map user and group names to ids and back
+**
+**  Every header names an owner, and looking one up can mean a round
+**  trip to a directory service, so each answer (including "no such
+**  user") is kept in a table on the handle for as long as it is open.
+**  The reentrant getpw*_r() and getgr*_r() calls are used, so handles
+**  in different threads don't share any state.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+
+/* kinds of lookup */
+#define ID_UID		0	/* user name to uid */
+#define ID_GID		1	/* group name to gid */
+#define ID_UNAME	2	/* uid to user name */
+#define ID_GNAME	3	/* gid to group name */
+
+/* a lookup and its answer */
+struct tar_id
+{
+	int kind;
+	const char *name;	/* key for ID_UID and ID_GID, else answer */
+	unsigned long id;	/* key for ID_UNAME and ID_GNAME, else answer */
+	int found;
+};
+
+
+static unsigned int
+id_hashfunc(struct tar_id *ti, unsigned int numbuckets)
+{
+	unsigned int h;
+
+	if (ti->kind == ID_UID || ti->kind == ID_GID)
+		h = libtar_str_hashfunc((char *)ti->name, numbuckets);
+	else
+		h = (unsigned int)ti->id * 2654435761U;
+
+	return ((h ^ ti->kind) % numbuckets);
+}
+
+
+static int
+id_match(struct tar_id *key, struct tar_id *ti)
+{
+	if (key->kind != ti->kind)
+		return 0;
+	if (key->kind == ID_UID || key->kind == ID_GID)
+		return (strcmp(key->name, ti->name) == 0);
+	return (key->id == ti->id);
+}
+
+
+/* ask the system, with a buffer that grows until the entry fits */
+static int
+id_resolve(struct tar_id *ti, char **name)
+{
+	struct passwd pw, *pwp = NULL;
+	struct group gr, *grp = NULL;
+	char *buf = NULL, *p;
+	long size;
+	int i;
+
+	size = sysconf(ti->kind == ID_UID || ti->kind == ID_UNAME
+		       ? _SC_GETPW_R_SIZE_MAX : _SC_GETGR_R_SIZE_MAX);
+	if (size <= 0)
+		size = 1024;
+
+	for (;;)
+	{
+		p = (char *)realloc(buf, size);
+		if (p == NULL)
+		{
+			free(buf);
+			return -1;
+		}
+		buf = p;
+
+		switch (ti->kind)
+		{
+		case ID_UID:
+			i = getpwnam_r(ti->name, &pw, buf, size, &pwp);
+			break;
+		case ID_UNAME:
+			i = getpwuid_r((uid_t)ti->id, &pw, buf, size, &pwp);
+			break;
+		case ID_GID:
+			i = getgrnam_r(ti->name, &gr, buf, size, &grp);
+			break;
+		default:
+			i = getgrgid_r((gid_t)ti->id, &gr, buf, size, &grp);
+			break;
+		}
+		if (i != ERANGE || size >= 1024 * 1024)
+			break;
+		size *= 2;
+	}
+
+	/* an error counts as "not found", as it did with getpwnam() */
+	*name = NULL;
+	if (pwp != NULL)
+	{
+		ti->found = 1;
+		ti->id = (ti->kind == ID_UID ? (unsigned long)pw.pw_uid
+			  : ti->id);
+		*name = pw.pw_name;
+	}
+	else if (grp != NULL)
+	{
+		ti->found = 1;
+		ti->id = (ti->kind == ID_GID ? (unsigned long)gr.gr_gid
+			  : ti->id);
+		*name = gr.gr_name;
+	}
+
+	/* the name has to outlive the buffer */
+	if (*name != NULL)
+		*name = strdup(*name);
+	free(buf);
+	if (ti->found && *name == NULL)
+		return -1;
+
+	return 0;
+}
+
+
+/* look up (or remember) key; returns NULL only if memory runs out */
+static struct tar_id *
+id_lookup(TAR *t, struct tar_id *key)
+{
+	struct tar_id *ti;
+	libtar_hashptr_t hp;
+	char *name;
+
+	if (t->ids == NULL)
+	{
+		t->ids = libtar_hash_new(64, (libtar_hashfunc_t)id_hashfunc);
+		if (t->ids == NULL)
+			return NULL;
+	}
+
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(t->ids, &hp, key,
+			       (libtar_matchfunc_t)id_match) != 0)
+		return (struct tar_id *)libtar_hashptr_data(&hp);
+
+	ti = (struct tar_id *)tar_arena_alloc(t, sizeof(struct tar_id));
+	if (ti == NULL)
+		return NULL;
+	*ti = *key;
+	ti->found = 0;
+	if (id_resolve(ti, &name) == -1)
+		return NULL;
+
+	/* keep whichever string isn't the key in the arena too */
+	if (ti->kind == ID_UID || ti->kind == ID_GID)
+		ti->name = tar_arena_strdup(t, key->name);
+	else if (name != NULL)
+		ti->name = tar_arena_strdup(t, name);
+	free(name);
+	if (ti->name == NULL && (ti->kind == ID_UID || ti->kind == ID_GID
+				 || ti->found))
+		return NULL;
+
+	if (libtar_hash_add(t->ids, ti) == -1)
+		return NULL;
+	return ti;
+}
+
+
+/* map a user name to a uid; returns 1 if found, 0 if not */
+int
+tar_id_uid(TAR *t, const char *name, uid_t *uid)
+{
+	struct tar_id key, *ti;
+
+	key.kind = ID_UID;
+	key.name = name;
+	ti = id_lookup(t, &key);
+	if (ti == NULL || !ti->found)
+		return 0;
+
+	*uid = (uid_t)ti->id;
+	return 1;
+}
+
+
+/* map a group name to a gid; returns 1 if found, 0 if not */
+int
+tar_id_gid(TAR *t, const char *name, gid_t *gid)
+{
+	struct tar_id key, *ti;
+
+	key.kind = ID_GID;
+	key.name = name;
+	ti = id_lookup(t, &key);
+	if (ti == NULL || !ti->found)
+		return 0;
+
+	*gid = (gid_t)ti->id;
+	return 1;
+}
+
+
+/* map a uid to a user name, or NULL */
+const char *
+tar_id_uname(TAR *t, uid_t uid)
+{
+	struct tar_id key, *ti;
+
+	key.kind = ID_UNAME;
+	key.id = (unsigned long)uid;
+	key.name = NULL;
+	ti = id_lookup(t, &key);
+
+	return (ti != NULL && ti->found ? ti->name : NULL);
+}
+
+
+/* map a gid to a group name, or NULL */
+const char *
+tar_id_gname(TAR *t, gid_t gid)
+{
+	struct tar_id key, *ti;
+
+	key.kind = ID_GNAME;
+	key.id = (unsigned long)gid;
+	key.name = NULL;
+	ti = id_lookup(t, &key);
+
+	return (ti != NULL && ti->found ? ti->name : NULL);
+}
@@ -15,6 +15,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
 #include <tar.h>
 
 #include <libtar_listhash.h>
@@ -34,11 +35,58 @@ extern "C"
 /* GNU extensions for typeflag */
 #define GNU_LONGNAME_TYPE	'L'
 #define GNU_LONGLINK_TYPE	'K'
+#define GNU_SPARSE_TYPE		'S'	/* old GNU sparse file */
 
 /* PAX (POSIX.1-2001) extensions for typeflag */
 #define PAX_EXTHDR_TYPE		'x'	/* extended header for next file */
 #define PAX_GLOBAL_TYPE		'g'	/* global extended header */
 
+/* an extended attribute from a SCHILY.xattr.* PAX record */
+struct tar_xattr
+{
+	char *name;
+	char *value;		/* may contain NULs, see len */
+	size_t len;
+};
+
+/* a run of data in a sparse file; everything else is a hole */
+struct tar_sparse
+{
+	off_t offset;
+	off_t numbytes;
+};
+
+/* values decoded from PAX extended headers */
+struct tar_pax
+{
+	int flags;		/* which numeric values are set, see below */
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	time_t atime;
+	long atime_nsec;
+	uid_t uid;
+	gid_t gid;
+	char *path;
+	char *linkpath;
+	char *uname;
+	char *gname;
+	struct tar_xattr *xattrs;
+	int nxattrs;
+	char *sparse_name;	/* GNU.sparse.name */
+	char *sparse_map;	/* GNU.sparse.map (format 0.1) */
+	off_t sparse_size;	/* GNU.sparse.size or GNU.sparse.realsize */
+	int sparse_major;	/* GNU.sparse.major (format 1.0) */
+};
+
+/* values for the tar_pax flags field */
+#define TAR_PAX_SIZE		 1
+#define TAR_PAX_MTIME		 2
+#define TAR_PAX_ATIME		 4
+#define TAR_PAX_UID		 8
+#define TAR_PAX_GID		16
+#define TAR_PAX_SPARSE		32	/* one of the GNU.sparse.* formats */
+
 /* our version of the tar header structure */
 struct tar_header
 {
@@ -63,6 +111,10 @@ struct tar_header
 	char *gnu_longlink;
 	char *pax_path;		/* path from PAX extended header */
 	char *pax_linkpath;	/* linkpath from PAX extended header */
+	struct tar_pax pax;	/* global and per-file PAX values */
+	struct tar_sparse *sparse;	/* data map, if TH_ISSPARSE() */
+	int nsparse;
+	off_t realsize;		/* logical size of a sparse file */
 };
 
 
@@ -72,6 +124,7 @@ typedef int (*openfunc_t)(const char *, int, ...);
 typedef int (*closefunc_t)(int);
 typedef ssize_t (*readfunc_t)(int, void *, size_t);
 typedef ssize_t (*writefunc_t)(int, const void *, size_t);
+typedef off_t (*seekfunc_t)(int, off_t, int);
 
 typedef struct
 {
@@ -79,9 +132,76 @@ typedef struct
 	closefunc_t closefunc;
 	readfunc_t readfunc;
 	writefunc_t writefunc;
+	seekfunc_t seekfunc;	/* optional; used to skip over file contents */
 }
 tartype_t;
 
+/* per-handle scratch buffers, reused for every header */
+#define TAR_SCRATCH_LONGNAME	0	/* GNU long name */
+#define TAR_SCRATCH_LONGLINK	1	/* GNU long link */
+#define TAR_SCRATCH_PAX		2	/* PAX extended header data */
+#define TAR_SCRATCH_XATTR	3	/* struct tar_xattr array */
+#define TAR_SCRATCH_SPARSE	4	/* struct tar_sparse array */
+#define TAR_SCRATCH_MAX		5
+
+struct tar_dircache;
+struct tar_arena;
+
+/*
+** with TAR_SKIP_UNCHANGED, asked about an existing file whose size, mtime
+** and mode match the entry about to replace it; returns 1 if its contents
+** are known to be the same too (e.g. from a manifest of hashes), 0 if it
+** must be rewritten
+*/
+typedef int (*tar_samefunc_t)(const char *realname, const struct stat *st,
+			      void *arg);
+
+/* how far the contents of the current entry have been read (stream.c) */
+struct tar_cursor
+{
+	off_t left;		/* archived bytes not yet consumed */
+	char *ptr;		/* consumed, but not yet handed out */
+	size_t avail;
+	int run;		/* sparse run being read */
+	off_t rundone;		/* bytes of it handed out */
+	off_t pos;		/* offset in the file of the next byte */
+};
+
+/* kinds of entry, from the typeflag and the mode's type bits */
+#define TAR_TYPE_OTHER		0
+#define TAR_TYPE_REG		1
+#define TAR_TYPE_LNK		2
+#define TAR_TYPE_SYM		3
+#define TAR_TYPE_CHR		4
+#define TAR_TYPE_BLK		5
+#define TAR_TYPE_DIR		6
+#define TAR_TYPE_FIFO		7
+
+/*
+** the current header, decoded once th_read() has all of it (or once
+** tar_append_file() has built it), so that the TH_IS*() and th_get_*()
+** accessors don't parse octal fields every time (decode.c)
+*/
+struct tar_entry
+{
+	int type;		/* TAR_TYPE_* */
+	mode_t mode;		/* as th_get_mode() */
+	off_t size;		/* archived bytes */
+	off_t realsize;		/* size once extracted */
+	time_t mtime;
+	long mtime_nsec;
+	time_t atime;
+	long atime_nsec;
+	uid_t uid;		/* as archived, before any name lookup */
+	gid_t gid;
+	unsigned long devmajor;
+	unsigned long devminor;
+	char *pathname;
+	char *linkname;
+	char namebuf[T_MAXPATHLEN + 2];	/* prefix/name, NUL-terminated */
+	char linkbuf[T_NAMELEN + 1];
+};
+
 typedef struct
 {
 	tartype_t *type;
@@ -90,7 +210,35 @@ typedef struct
 	int oflags;
 	int options;
 	struct tar_header th_buf;
+	struct tar_entry entry;	/* th_buf, decoded */
 	libtar_hash_t *h;
+	char *rbuf;		/* read-ahead buffer (allocated on first read) */
+	size_t rbufsize;	/* size of rbuf, a multiple of T_BLOCKSIZE */
+	size_t rbufpos;		/* offset of the next unconsumed byte in rbuf */
+	size_t rbuflen;		/* number of valid bytes in rbuf */
+	char *wbuf;		/* output buffer (allocated on first write) */
+	size_t wbufsize;	/* size of wbuf, a multiple of T_BLOCKSIZE */
+	size_t wbuflen;		/* bytes in wbuf not yet written */
+	void *map;		/* archive mapping (tar_mmap_open() only) */
+	size_t mapsize;		/* size of map */
+	off_t offset;		/* archive offset of the next unread byte */
+	off_t th_offset;	/* archive offset of the current entry's
+				   first header (incl. GNU/PAX headers) */
+	int noseek;		/* seekfunc failed, skip by reading */
+	int nokcopy;		/* kernel copy methods that failed (extract.c) */
+	uid_t euid;		/* geteuid() when the handle was opened */
+	char *scratch[TAR_SCRATCH_MAX];
+	size_t scratchsize[TAR_SCRATCH_MAX];
+	struct tar_pax pax_global;	/* from PAX global headers so far */
+	char **pax_gdata;		/* data of every global header */
+	int pax_ngdata;
+	struct tar_dircache *dircache;	/* open directories (dircache.c) */
+	struct tar_arena *arena;	/* bookkeeping memory (arena.c) */
+	struct tar_cursor cursor;	/* reading the current entry */
+	tar_samefunc_t samefunc;	/* for TAR_SKIP_UNCHANGED */
+	void *samearg;
+	libtar_hash_t *dedup;		/* payloads written (dedup.c) */
+	libtar_hash_t *ids;		/* owner name lookups (idcache.c) */
 }
 TAR;
 
@@ -102,10 +250,23 @@ TAR;
 #define TAR_CHECK_MAGIC		16	/* check magic in file header */
 #define TAR_CHECK_VERSION	32	/* check version in file header */
 #define TAR_IGNORE_CRC		64	/* ignore CRC in file header */
+#define TAR_SPARSE		128	/* archive holes as PAX sparse files */
+#define TAR_RESOLVE_BENEATH	256	/* don't extract outside the prefix */
+#define TAR_PREALLOCATE		512	/* reserve space for extracted files */
+#define TAR_SKIP_UNCHANGED	1024	/* leave files that match alone */
+#define TAR_DEDUP		2048	/* clone files with the same contents */
+#define TAR_DEDUP_HARDLINK	4096	/* or hardlink them (with TAR_DEDUP) */
+#define TAR_NUMERIC_OWNER	8192	/* don't map owners to and from names */
 
 /* this is obsolete - it's here for backwards-compatibility only */
 #define TAR_IGNORE_MAGIC	0
 
+/* default size of the read-ahead buffer used for O_RDONLY handles */
+#define TAR_READBUF_DEFAULT	(256 * 1024)
+
+/* default size of the output buffer used for O_WRONLY handles */
+#define TAR_WRITEBUF_DEFAULT	(256 * 1024)
+
 extern const char libtar_version[];
 
 
@@ -117,10 +278,34 @@ int tar_open(TAR **t, const char *pathname, tartype_t *type,
 int tar_fdopen(TAR **t, int fd, const char *pathname, tartype_t *type,
 	       int oflags, int mode, int options);
 
+/*
+** open an existing tarfile read-only and map it into memory; blocks are
+** served straight from the mapping, which several handles on the same
+** file share through the page cache
+*/
+int tar_mmap_open(TAR **t, const char *pathname, int options);
+
 /* returns the descriptor associated with t */
 int tar_fd(TAR *t);
 
-/* close tarfile handle */
+/*
+** set the size of the read-ahead buffer (rounded up to a multiple of
+** T_BLOCKSIZE); a size of T_BLOCKSIZE reads one block per readfunc call.
+** must be called before the first th_read()
+*/
+int tar_set_readbuf(TAR *t, size_t size);
+
+/*
+** set the size of the output buffer (rounded up to a multiple of
+** T_BLOCKSIZE); a size of T_BLOCKSIZE writes one block per writefunc
+** call.  must be called before anything is appended
+*/
+int tar_set_writebuf(TAR *t, size_t size);
+
+/*
+** close tarfile handle; fails if buffered output can't be written or
+** deferred directory metadata can't be applied
+*/
 int tar_close(TAR *t);
 
 
@@ -129,7 +314,7 @@ int tar_close(TAR *t);
 /* forward declaration to appease the compiler */
 struct tar_dev;
 
-/* cleanup function */
+/* this is obsolete - it's here for backwards-compatibility only */
 void tar_dev_free(struct tar_dev *tdp);
 
 /* Appends a file to the tar archive.
@@ -149,54 +334,141 @@ int tar_append_regfile(TAR *t, const char *realname);
 
 /***** block.c *************************************************************/
 
-/* macros for reading/writing tarchive blocks */
-#define tar_block_read(t, buf) \
-	(*((t)->type->readfunc))((t)->fd, (char *)(buf), T_BLOCKSIZE)
-#define tar_block_write(t, buf) \
-	(*((t)->type->writefunc))((t)->fd, (char *)(buf), T_BLOCKSIZE)
+/*
+** read a single block, served from the read-ahead buffer
+** returns T_BLOCKSIZE on success, 0 at EOF, the number of bytes in a
+** trailing partial block, or -1 (and sets errno) on error
+*/
+int tar_block_read(TAR *t, void *buf);
+
+/*
+** write a single block through the output buffer, which only reaches the
+** writefunc when it fills up, in tar_append_eof() or in tar_close()
+** returns T_BLOCKSIZE on success, or -1 (and sets errno) on error
+*/
+int tar_block_write(TAR *t, const void *buf);
+
+/*
+** write out whatever is in the output buffer, e.g. before writing to
+** tar_fd() directly
+*/
+int tar_flush(TAR *t);
 
 /* read/write a header block */
 int th_read(TAR *t);
 int th_write(TAR *t);
 
 
+/***** index.c *************************************************************/
+
+/* one archive member, as reported by tar_scan() and tar_build_index() */
+typedef struct
+{
+	char *path;		/* full pathname (GNU/PAX long names resolved) */
+	char *linkname;		/* link target, or NULL */
+	off_t header_offset;	/* first header block of the entry */
+	off_t data_offset;	/* first byte of the entry's contents */
+	off_t size;		/* size of the entry's contents */
+	time_t mtime;
+	mode_t mode;
+	char typeflag;		/* GNU_SPARSE_TYPE for any sparse file */
+}
+tar_index_entry_t;
+
+typedef struct
+{
+	tar_index_entry_t *entries;	/* sorted by path */
+	size_t nentries;
+	char *strings;			/* storage for path and linkname */
+	size_t stringsize;
+	off_t archive_size;		/* archive it was built from */
+	time_t archive_mtime;
+}
+tar_index_t;
+
+/*
+** callback for tar_scan(); the entry is only valid during the call
+** returns 0 to continue, anything else stops the scan
+*/
+typedef int (*tar_scanfunc_t)(TAR *t, const tar_index_entry_t *e,
+			      void *arg);
+
+/*
+** decode every header from the current position on without reading file
+** contents, which are seeked over when the descriptor allows it
+** returns 0 at the end of the archive, the callback's non-zero return
+** value if it stopped the scan, or -1 (and sets errno) on error
+*/
+int tar_scan(TAR *t, tar_scanfunc_t func, void *arg);
+
+/*
+** scan the archive from its current position and record every entry;
+** offsets are relative to where the handle started reading
+*/
+int tar_build_index(TAR *t, tar_index_t **idx);
+
+/* return the last entry stored under path, or NULL */
+const tar_index_entry_t *tar_index_lookup(tar_index_t *idx,
+					  const char *path);
+
+/* save an index to a sidecar file */
+int tar_index_save(tar_index_t *idx, const char *pathname);
+
+/*
+** load an index from a sidecar file; fails with ESTALE if the size or
+** mtime of the archive open on archive_fd don't match the index
+*/
+int tar_index_load(tar_index_t **idx, const char *pathname, int archive_fd);
+
+/*
+** read part of an entry's contents straight from the archive
+** (not supported for sparse files)
+*/
+ssize_t tar_index_pread(int archive_fd, const tar_index_entry_t *e,
+			void *buf, size_t count, off_t offset);
+
+void tar_index_free(tar_index_t *idx);
+
+
 /***** decode.c ************************************************************/
 
-/* determine file type */
-#define TH_ISREG(t)	((t)->th_buf.typeflag == REGTYPE \
-			 || (t)->th_buf.typeflag == AREGTYPE \
-			 || (t)->th_buf.typeflag == CONTTYPE \
-			 || (S_ISREG((mode_t)oct_to_int((t)->th_buf.mode)) \
-			     && (t)->th_buf.typeflag != LNKTYPE))
-#define TH_ISLNK(t)	((t)->th_buf.typeflag == LNKTYPE)
-#define TH_ISSYM(t)	((t)->th_buf.typeflag == SYMTYPE \
-			 || S_ISLNK((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISCHR(t)	((t)->th_buf.typeflag == CHRTYPE \
-			 || S_ISCHR((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISBLK(t)	((t)->th_buf.typeflag == BLKTYPE \
-			 || S_ISBLK((mode_t)oct_to_int((t)->th_buf.mode)))
-#define TH_ISDIR(t)	((t)->th_buf.typeflag == DIRTYPE \
-			 || S_ISDIR((mode_t)oct_to_int((t)->th_buf.mode)) \
-			 || ((t)->th_buf.typeflag == AREGTYPE \
-			     && ((t)->th_buf.name[strlen((t)->th_buf.name) - 1] == '/')))
-#define TH_ISFIFO(t)	((t)->th_buf.typeflag == FIFOTYPE \
-			 || S_ISFIFO((mode_t)oct_to_int((t)->th_buf.mode)))
+/* determine file type (of the decoded entry) */
+#define TH_ISREG(t)	((t)->entry.type == TAR_TYPE_REG)
+#define TH_ISLNK(t)	((t)->entry.type == TAR_TYPE_LNK)
+#define TH_ISSYM(t)	((t)->entry.type == TAR_TYPE_SYM)
+#define TH_ISCHR(t)	((t)->entry.type == TAR_TYPE_CHR)
+#define TH_ISBLK(t)	((t)->entry.type == TAR_TYPE_BLK)
+#define TH_ISDIR(t)	((t)->entry.type == TAR_TYPE_DIR)
+#define TH_ISFIFO(t)	((t)->entry.type == TAR_TYPE_FIFO)
+
+/* extension headers are recognized before anything is decoded */
 #define TH_ISLONGNAME(t)	((t)->th_buf.typeflag == GNU_LONGNAME_TYPE)
 #define TH_ISLONGLINK(t)	((t)->th_buf.typeflag == GNU_LONGLINK_TYPE)
 #define TH_ISPAX(t)		((t)->th_buf.typeflag == PAX_EXTHDR_TYPE)
 #define TH_ISPAXGLOBAL(t)	((t)->th_buf.typeflag == PAX_GLOBAL_TYPE)
+#define TH_ISSPARSE(t)		((t)->th_buf.sparse != NULL)
 
 /* decode tar header info */
-#define th_get_crc(t) oct_to_int((t)->th_buf.chksum)
-#define th_get_size(t) oct_to_int((t)->th_buf.size)
-#define th_get_mtime(t) oct_to_int((t)->th_buf.mtime)
-#define th_get_devmajor(t) oct_to_int((t)->th_buf.devmajor)
-#define th_get_devminor(t) oct_to_int((t)->th_buf.devminor)
-#define th_get_linkname(t) ((t)->th_buf.pax_linkpath \
-                            ? (t)->th_buf.pax_linkpath \
-                            : ((t)->th_buf.gnu_longlink \
-                               ? (t)->th_buf.gnu_longlink \
-                               : (t)->th_buf.linkname))
+#define th_get_field(t, f) \
+	oct_to_int64((t)->th_buf.f, sizeof((t)->th_buf.f))
+#define th_get_rawmode(t) ((mode_t)th_get_field((t), mode))
+#define th_get_crc(t) ((int)th_get_field((t), chksum))
+#define th_get_size(t) ((t)->entry.size)
+/* the size of the file once extracted; th_get_size() is what's archived */
+#define th_get_realsize(t) ((t)->entry.realsize)
+#define th_get_mtime(t) ((t)->entry.mtime)
+#define th_get_mtime_nsec(t) ((t)->entry.mtime_nsec)
+#define th_get_atime(t) ((t)->entry.atime)
+#define th_get_atime_nsec(t) ((t)->entry.atime_nsec)
+#define th_get_devmajor(t) ((t)->entry.devmajor)
+#define th_get_devminor(t) ((t)->entry.devminor)
+#define th_get_linkname(t) ((t)->entry.linkname)
+
+/*
+** decode th_buf into t->entry; th_read() and tar_append_file() do this,
+** and anything else that changes th_buf has to do it again
+*/
+void th_decode(TAR *t);
 char *th_get_pathname(TAR *t);
 mode_t th_get_mode(TAR *t);
 uid_t th_get_uid(TAR *t);
@@ -227,7 +499,11 @@ void th_finish(TAR *t);
 
 /***** extract.c ***********************************************************/
 
-/* sequentially extract next file from t */
+/*
+** sequentially extract next file from t; the mode and times of
+** directories are set once tar_extract_all() or tar_extract_glob() is
+** done, or by tar_close() when extracting file by file
+*/
 int tar_extract_file(TAR *t, char *realname);
 
 /* extract different file types */
@@ -238,10 +514,30 @@ int tar_extract_chardev(TAR *t, char *realname);
 int tar_extract_blockdev(TAR *t, char *realname);
 int tar_extract_fifo(TAR *t, char *realname);
 
-/* for regfiles, we need to extract the content blocks as well */
+/*
+** for regfiles, we need to extract the content blocks as well; skipping
+** starts wherever tar_entry_read() or tar_extract_to_sink() left off
+*/
 int tar_extract_regfile(TAR *t, char *realname);
 int tar_skip_regfile(TAR *t);
 
+/*
+** with TAR_SKIP_UNCHANGED, a regfile is skipped rather than rewritten
+** when a regular file of the same size, mtime and mode (and owner, when
+** extracting as root) is already there; func, if not NULL, gets the last
+** word on whether its contents are the same.  hardlinks that are still
+** in place are kept, and devices and FIFOs are recreated
+*/
+void tar_set_samefunc(TAR *t, tar_samefunc_t func, void *arg);
+
+/*
+** return the contents of the current regfile as a slice of the mapping
+** of a tar_mmap_open() handle and skip past it; the slice stays valid
+** until tar_close()  (fails with EINVAL for sparse files, whose data
+** isn't stored contiguously)
+*/
+int tar_regfile_data(TAR *t, const char **data, size_t *size);
+
 
 /***** output.c ************************************************************/
 
@@ -272,6 +568,12 @@ int ino_hash(ino_t *inode);
 /* create any necessary dirs */
 int mkdirhier(char *path);
 
+/*
+** sum a block as unsigned and as signed bytes in a single pass
+** returns 1 if the block is all zeros, 0 otherwise
+*/
+int tar_block_sum(const void *block, int *usum, int *ssum);
+
 /* calculate header checksum */
 int th_crc_calc(TAR *t);
 
@@ -279,17 +581,96 @@ int th_crc_calc(TAR *t);
 int th_signed_crc_calc(TAR *t);
 
 /* compare checksums in a forgiving way */
-#define th_crc_ok(t) (th_get_crc(t) == th_crc_calc(t) || th_get_crc(t) == th_signed_crc_calc(t))
+int th_crc_ok(TAR *t);
+
+/*
+** numeric header field to integer conversion; understands octal as well
+** as the GNU base-256 encoding used for values that don't fit
+*/
+int64_t oct_to_int64(const char *oct, size_t octlen);
 
-/* string-octal to integer conversion */
+/*
+** integer to numeric header field conversion; writes zero-padded octal
+** followed by a space (and a NUL if nul is set), or base-256 if the value
+** doesn't fit in that many digits
+*/
+void int64_to_oct(int64_t num, char *oct, size_t octlen, int nul);
+
+/*
+** string-octal to integer conversion of a NUL-terminated string, as it
+** has always been; use oct_to_int64() for header fields, which needn't be
+*/
 int oct_to_int(char *oct);
 
 /* integer to NULL-terminated string-octal conversion */
 #define int_to_oct(num, oct, octlen) \
-	snprintf((oct), (octlen), "%*lo ", (octlen) - 2, (unsigned long)(num))
+	int64_to_oct((num), (oct), (octlen), 1)
 
 /* integer to string-octal conversion, no NULL */
-void int_to_oct_nonull(int num, char *oct, size_t octlen);
+void int_to_oct_nonull(int64_t num, char *oct, size_t octlen);
+
+
+/***** selector.c *********************************************************/
+
+typedef struct tar_selector tar_selector_t;
+
+/* rule types for tar_selector_add() */
+#define TAR_SEL_PATH	1	/* this exact path */
+#define TAR_SEL_PREFIX	2	/* this path and everything below it */
+#define TAR_SEL_GLOB	4	/* fnmatch() pattern, FNM_PATHNAME | FNM_PERIOD */
+#define TAR_SEL_EXCLUDE	8	/* or'd in: never select what this matches */
+
+/*
+** A selector picks archive entries by path.  A leading "./" and trailing
+** slashes are ignored in both rules and paths.  With no include rules,
+** every entry is selected; otherwise an entry is selected when it
+** matches an include rule and no exclude rule.
+*/
+tar_selector_t *tar_selector_new(void);
+int tar_selector_add(tar_selector_t *s, int type, const char *pattern);
+void tar_selector_free(tar_selector_t *s);
+
+/* returns 1 if path is selected, 0 if not */
+int tar_selector_match(tar_selector_t *s, const char *path);
+
+/*
+** returns 1 if the include rules are all exact paths and every one of
+** them has been matched since the selector was made or last reset, i.e.
+** nothing later in the archive can be selected
+*/
+int tar_selector_done(tar_selector_t *s);
+
+/* forget which paths have been matched, to use s on another archive */
+void tar_selector_reset(tar_selector_t *s);
+
+
+/***** stream.c ************************************************************/
+
+/*
+** callback for tar_extract_to_sink(); buf holds len bytes that belong at
+** offset in the file, and is only valid during the call
+** returns 0 to continue, anything else stops
+*/
+typedef int (*tar_sinkfunc_t)(TAR *t, const char *buf, size_t len,
+			      off_t offset, void *arg);
+
+/*
+** pass the contents of the current regfile to func, in pieces taken
+** straight from the read-ahead buffer or mapping; the holes of a sparse
+** file are left out, so offsets skip over them
+** returns 0 once the whole file has been passed on and the handle is at
+** the next header, the callback's non-zero return value if it stopped
+** (tar_skip_regfile() skips the rest), or -1 (and sets errno) on error
+*/
+int tar_extract_to_sink(TAR *t, tar_sinkfunc_t func, void *arg);
+
+/*
+** read up to count bytes of the current regfile into buf, holes of a
+** sparse file as zeros, continuing where the last call left off
+** returns the number of bytes read (0 at the end of the file), or -1
+** (and sets errno) on error; tar_skip_regfile() skips what's left
+*/
+ssize_t tar_entry_read(TAR *t, void *buf, size_t count);
 
 
 /***** wrapper.c **********************************************************/
@@ -298,11 +679,80 @@ void int_to_oct_nonull(int num, char *oct, size_t octlen);
 int tar_extract_glob(TAR *t, char *globname, char *prefix);
 int tar_extract_all(TAR *t, char *prefix);
 
+/*
+** extract the entries chosen by a selector; when it only names exact
+** paths, reading stops once all of them have been extracted, so unlike
+** tar_extract_all(), a later copy of one of those paths appended to the
+** archive isn't extracted over the first
+*/
+int tar_extract_selected(TAR *t, tar_selector_t *s, char *prefix);
+
+/*
+** remove everything below prefix that hasn't been extracted (or left in
+** place by TAR_SKIP_UNCHANGED) through t, i.e. what an earlier version
+** of the archive left behind; prefix itself is kept.  fails with EINVAL,
+** removing nothing, if nothing was extracted below prefix
+*/
+int tar_extract_prune(TAR *t, char *prefix);
+
 /* add a whole tree of files */
 int tar_append_tree(TAR *t, char *realdir, char *savedir);
 
 int tar_is_reg(TAR *t);
 
+
+/***** parallel.c *********************************************************/
+
+/* most payload bytes held in memory by tar_extract_all_parallel() */
+#define TAR_PARALLEL_INFLIGHT	(64 * 1024 * 1024)
+
+/*
+** like tar_extract_all(), but files are created and written by a pool of
+** nthreads worker threads (0 for one per CPU) while the calling thread
+** reads the archive; directories, symlinks and other special files are
+** created in archive order by the calling thread, and hardlinks once all
+** files are written.  the files waiting for a worker are limited by
+** TAR_PARALLEL_INFLIGHT and by RLIMIT_NOFILE
+*/
+int tar_extract_all_parallel(TAR *t, char *prefix, int nthreads);
+
+
+/***** arena.c ************************************************************/
+
+/*
+** where the memory for a handle's bookkeeping (names remembered for
+** hardlinks, inode tables) comes from: allocfunc returns size bytes or
+** NULL, which fails the operation with ENOMEM; freefunc gets the same
+** size back.  ctx is passed to both.
+*/
+typedef void *(*tar_allocfunc_t)(void *, size_t);
+typedef void (*tar_freefunc_t)(void *, void *, size_t);
+
+typedef struct
+{
+	tar_allocfunc_t allocfunc;
+	tar_freefunc_t freefunc;
+	void *ctx;
+}
+tar_allocator_t;
+
+struct tar_arena_stats
+{
+	size_t nallocs;		/* allocations made */
+	size_t used;		/* bytes handed out, including alignment */
+	size_t reserved;	/* bytes obtained from the allocator */
+	size_t nchunks;		/* allocator calls */
+};
+
+/*
+** replace the allocator (NULL for malloc() and free()); must be called
+** before the handle allocates anything, or fails with EBUSY
+*/
+int tar_set_allocator(TAR *t, const tar_allocator_t *allocator);
+
+/* report the bookkeeping memory allocated so far */
+void tar_arena_stats(TAR *t, struct tar_arena_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
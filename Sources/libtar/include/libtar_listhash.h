@@ -126,27 +126,42 @@ int libtar_str_match(char *, char *);
 /***** hash.c **********************************************************/
 
 /*
-** Hashing function (determines which bucket the given key hashes into)
+** Hashing function (determines which slot the given key hashes into)
 ** first argument is the key to hash
-** second argument is the total number of buckets
-** returns the bucket number
+** second argument is the total number of buckets; the table always
+** passes UINT_MAX and spreads the result over its slots itself, so
+** any well-distributed value will do
+** returns the hash value
 */
 typedef unsigned int (*libtar_hashfunc_t)(void *, unsigned int);
 
 
 struct libtar_hashptr
 {
-	int bucket;
-	libtar_listptr_t node;
+	int bucket;		/* slot of the current entry, or -1 */
+	void *data;		/* the current entry */
 };
 typedef struct libtar_hashptr libtar_hashptr_t;
 
+/* one slot of the open-addressing table */
+struct libtar_hashslot
+{
+	unsigned int hash;	/* full hash value of data */
+	void *data;		/* NULL if empty */
+};
+
+/*
+** an open-addressing (linear probing) table that doubles in size when
+** three quarters full; adding entries invalidates hash pointers
+*/
 struct libtar_hash
 {
-	int numbuckets;
-	libtar_list_t **table;
+	int numbuckets;		/* number of slots, a power of two */
+	struct libtar_hashslot *table;
 	libtar_hashfunc_t hashfunc;
 	unsigned int nents;
+	unsigned int nused;	/* entries plus deleted slots */
+	int shift;		/* 32 - log2(numbuckets) */
 };
 typedef struct libtar_hash libtar_hash_t;
 
@@ -0,0 +1,490 @@
+/*
+**  index.c - libtar code to scan an archive's headers and to build, save
+**  and load a random-access index
+**
+**  The sidecar file is a fixed header followed by one record per entry
+**  and the string table.  All integers are stored little-endian:
+**
+**	magic[4] version[4] archive_size[8] archive_mtime[8]
+**	nentries[8] stringsize[8] reserved[8]
+**	{ header_offset[8] data_offset[8] size[8] mtime[8]
+**	  path[8] linkname[8] mode[4] typeflag[1] pad[3] } * nentries
+**	strings[stringsize]
+**
+**  path and linkname are offsets into the string table; a linkname of
+**  all ones means there is no link target.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+
+#define INDEX_MAGIC		"LTIX"
+#define INDEX_VERSION		1
+#define INDEX_HDRSIZE		48
+#define INDEX_RECSIZE		56
+#define INDEX_NOLINK		((unsigned long long)-1)
+
+
+static void
+put64(unsigned char *p, unsigned long long v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		p[i] = (unsigned char)v;
+}
+
+
+static unsigned long long
+get64(const unsigned char *p)
+{
+	unsigned long long v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+
+static void
+put32(unsigned char *p, unsigned long v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, v >>= 8)
+		p[i] = (unsigned char)v;
+}
+
+
+static unsigned long
+get32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+		| ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+
+static int
+index_entry_cmp(const void *p1, const void *p2)
+{
+	const tar_index_entry_t *e1 = p1, *e2 = p2;
+	int i;
+
+	i = strcmp(e1->path, e2->path);
+	if (i != 0)
+		return i;
+
+	/* keep duplicates in archive order so the last one wins */
+	return (e1->header_offset > e2->header_offset)
+		- (e1->header_offset < e2->header_offset);
+}
+
+
+/* append a string to the string table, returning its offset */
+static int
+index_add_string(tar_index_t *idx, size_t *cap, const char *str,
+		 size_t *off)
+{
+	size_t len = strlen(str) + 1;
+	char *p;
+
+	if (idx->stringsize + len > *cap)
+	{
+		while (idx->stringsize + len > *cap)
+			*cap = (*cap ? *cap * 2 : 4096);
+		p = (char *)realloc(idx->strings, *cap);
+		if (p == NULL)
+			return -1;
+		idx->strings = p;
+	}
+
+	memcpy(idx->strings + idx->stringsize, str, len);
+	*off = idx->stringsize;
+	idx->stringsize += len;
+
+	return 0;
+}
+
+
+/*
+** turn string table offsets (kept aside while the table may still move)
+** into pointers, then sort if needed
+*/
+static void
+index_finish(tar_index_t *idx, size_t *offs, int sort)
+{
+	size_t i;
+
+	for (i = 0; i < idx->nentries; i++)
+	{
+		idx->entries[i].path = idx->strings + offs[2 * i];
+		idx->entries[i].linkname = (offs[2 * i + 1] == (size_t)-1
+					    ? NULL
+					    : idx->strings + offs[2 * i + 1]);
+	}
+
+	if (sort)
+		qsort(idx->entries, idx->nentries, sizeof(tar_index_entry_t),
+		      index_entry_cmp);
+}
+
+
+struct index_build
+{
+	tar_index_t *idx;
+	size_t ecap;		/* allocated entries */
+	size_t scap;		/* allocated string table */
+	size_t *offs;		/* path/linkname string table offsets */
+};
+
+
+static int
+index_build_entry(struct index_build *b, const tar_index_entry_t *e)
+{
+	tar_index_t *idx = b->idx;
+	void *p;
+
+	if (idx->nentries == b->ecap)
+	{
+		b->ecap = (b->ecap ? b->ecap * 2 : 256);
+		p = realloc(idx->entries, b->ecap * sizeof(tar_index_entry_t));
+		if (p == NULL)
+			return -1;
+		idx->entries = (tar_index_entry_t *)p;
+		p = realloc(b->offs, b->ecap * 2 * sizeof(size_t));
+		if (p == NULL)
+			return -1;
+		b->offs = (size_t *)p;
+	}
+
+	idx->entries[idx->nentries] = *e;
+	if (index_add_string(idx, &(b->scap), e->path,
+			     &(b->offs[2 * idx->nentries])) == -1)
+		return -1;
+	b->offs[2 * idx->nentries + 1] = (size_t)-1;
+	if (e->linkname != NULL
+	    && index_add_string(idx, &(b->scap), e->linkname,
+				&(b->offs[2 * idx->nentries + 1])) == -1)
+		return -1;
+
+	idx->nentries++;
+	return 0;
+}
+
+
+/* hand every entry to func, or add it to the index being built in b */
+static int
+index_scan(TAR *t, tar_scanfunc_t func, void *arg, struct index_build *b)
+{
+	tar_index_entry_t e;
+	int i;
+
+	while ((i = th_read(t)) == 0)
+	{
+		e.path = th_get_pathname(t);
+		e.linkname = ((TH_ISLNK(t) || TH_ISSYM(t))
+			      ? th_get_linkname(t)
+			      : NULL);
+		e.header_offset = t->th_offset;
+		e.data_offset = t->offset;
+		e.size = (TH_ISREG(t) ? th_get_size(t) : 0);
+		e.mtime = th_get_mtime(t);
+		e.mode = th_get_mode(t);
+		e.typeflag = (TH_ISSPARSE(t)
+			      ? GNU_SPARSE_TYPE
+			      : t->th_buf.typeflag);
+
+		i = (b != NULL ? index_build_entry(b, &e)
+		     : (*func)(t, &e, arg));
+		if (i != 0)
+			return i;
+
+		if (TH_ISREG(t) && tar_skip_regfile(t) != 0)
+			return -1;
+	}
+
+	return (i == 1 ? 0 : -1);
+}
+
+
+int
+tar_scan(TAR *t, tar_scanfunc_t func, void *arg)
+{
+	return index_scan(t, func, arg, NULL);
+}
+
+
+int
+tar_build_index(TAR *t, tar_index_t **idx)
+{
+	struct index_build b;
+	struct stat s;
+
+	memset(&b, 0, sizeof(b));
+	b.idx = (tar_index_t *)calloc(1, sizeof(tar_index_t));
+	if (b.idx == NULL)
+		return -1;
+
+	if (fstat(t->fd, &s) == 0)
+	{
+		b.idx->archive_size = s.st_size;
+		b.idx->archive_mtime = s.st_mtime;
+	}
+
+	if (index_scan(t, NULL, NULL, &b) != 0)
+	{
+		free(b.offs);
+		tar_index_free(b.idx);
+		return -1;
+	}
+
+#ifdef DEBUG
+	printf("    tar_build_index(): %zu entries, %zu bytes of strings\n",
+	       b.idx->nentries, b.idx->stringsize);
+#endif
+	index_finish(b.idx, b.offs, 1);
+	free(b.offs);
+
+	*idx = b.idx;
+	return 0;
+}
+
+
+const tar_index_entry_t *
+tar_index_lookup(tar_index_t *idx, const char *path)
+{
+	size_t lo = 0, hi = idx->nentries, mid;
+	int i;
+
+	/* find the first entry after the run of matching paths */
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		i = strcmp(idx->entries[mid].path, path);
+		if (i <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0 || strcmp(idx->entries[lo - 1].path, path) != 0)
+		return NULL;
+
+	return &(idx->entries[lo - 1]);
+}
+
+
+int
+tar_index_save(tar_index_t *idx, const char *pathname)
+{
+	unsigned char hdr[INDEX_HDRSIZE];
+	unsigned char *buf, *p;
+	tar_index_entry_t *e;
+	size_t i, len;
+	FILE *f;
+	int rv = 0;
+
+	len = idx->nentries * INDEX_RECSIZE;
+	buf = (unsigned char *)calloc(1, len ? len : 1);
+	if (buf == NULL)
+		return -1;
+
+	memcpy(hdr, INDEX_MAGIC, 4);
+	hdr[4] = INDEX_VERSION;
+	hdr[5] = hdr[6] = hdr[7] = 0;
+	put64(hdr + 8, idx->archive_size);
+	put64(hdr + 16, idx->archive_mtime);
+	put64(hdr + 24, idx->nentries);
+	put64(hdr + 32, idx->stringsize);
+	put64(hdr + 40, 0);
+
+	for (i = 0, p = buf; i < idx->nentries; i++, p += INDEX_RECSIZE)
+	{
+		e = &(idx->entries[i]);
+		put64(p, e->header_offset);
+		put64(p + 8, e->data_offset);
+		put64(p + 16, e->size);
+		put64(p + 24, e->mtime);
+		put64(p + 32, e->path - idx->strings);
+		put64(p + 40, (e->linkname
+			       ? (unsigned long long)(e->linkname - idx->strings)
+			       : INDEX_NOLINK));
+		put32(p + 48, e->mode);
+		p[52] = (unsigned char)e->typeflag;
+	}
+
+	f = fopen(pathname, "wb");
+	if (f == NULL)
+	{
+		free(buf);
+		return -1;
+	}
+	if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	    || fwrite(buf, 1, len, f) != len
+	    || fwrite(idx->strings, 1, idx->stringsize, f) != idx->stringsize)
+		rv = -1;
+	if (fclose(f) != 0)
+		rv = -1;
+	free(buf);
+
+	return rv;
+}
+
+
+int
+tar_index_load(tar_index_t **idx, const char *pathname, int archive_fd)
+{
+	unsigned char hdr[INDEX_HDRSIZE];
+	unsigned char *buf = NULL, *p;
+	unsigned long long n, off, left;
+	size_t *offs = NULL;
+	tar_index_entry_t *e;
+	struct stat s, is;
+	size_t i;
+	FILE *f;
+
+	*idx = NULL;
+	if (fstat(archive_fd, &s) == -1)
+		return -1;
+
+	f = fopen(pathname, "rb");
+	if (f == NULL)
+		return -1;
+
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	    || memcmp(hdr, INDEX_MAGIC, 4) != 0
+	    || hdr[4] != INDEX_VERSION)
+	{
+		errno = EINVAL;
+		goto fail;
+	}
+
+	/* refuse an index that was built from a different archive */
+	if ((off_t)get64(hdr + 8) != s.st_size
+	    || (time_t)get64(hdr + 16) != s.st_mtime)
+	{
+		errno = ESTALE;
+		goto fail;
+	}
+
+	*idx = (tar_index_t *)calloc(1, sizeof(tar_index_t));
+	if (*idx == NULL)
+		goto fail;
+	(*idx)->archive_size = s.st_size;
+	(*idx)->archive_mtime = s.st_mtime;
+
+	/* the counts can't promise more than the index file holds */
+	if (fstat(fileno(f), &is) == -1)
+		goto fail;
+	left = (unsigned long long)is.st_size - INDEX_HDRSIZE;
+	n = get64(hdr + 24);
+	off = get64(hdr + 32);
+	if (n > left / INDEX_RECSIZE || off > left - n * INDEX_RECSIZE
+	    || n > ((size_t)-1 / INDEX_RECSIZE) || off > (size_t)-1)
+	{
+		errno = EINVAL;
+		goto fail;
+	}
+	(*idx)->nentries = (size_t)n;
+	(*idx)->stringsize = (size_t)off;
+
+	buf = (unsigned char *)malloc(n * INDEX_RECSIZE + 1);
+	(*idx)->entries = (tar_index_entry_t *)calloc(n + 1,
+						      sizeof(tar_index_entry_t));
+	(*idx)->strings = (char *)malloc((size_t)off + 1);
+	offs = (size_t *)malloc((n + 1) * 2 * sizeof(size_t));
+	if (buf == NULL || (*idx)->entries == NULL
+	    || (*idx)->strings == NULL || offs == NULL)
+		goto fail;
+
+	if (fread(buf, INDEX_RECSIZE, n, f) != n
+	    || fread((*idx)->strings, 1, (size_t)off, f) != (size_t)off)
+	{
+		errno = EINVAL;
+		goto fail;
+	}
+	/* make sure a corrupt table can't run off the end */
+	(*idx)->strings[off] = '\0';
+
+	for (i = 0, p = buf; i < n; i++, p += INDEX_RECSIZE)
+	{
+		e = &((*idx)->entries[i]);
+		e->header_offset = (off_t)get64(p);
+		e->data_offset = (off_t)get64(p + 8);
+		e->size = (off_t)get64(p + 16);
+		e->mtime = (time_t)get64(p + 24);
+		offs[2 * i] = (size_t)get64(p + 32);
+		offs[2 * i + 1] = (get64(p + 40) == INDEX_NOLINK
+				   ? (size_t)-1
+				   : (size_t)get64(p + 40));
+		e->mode = (mode_t)get32(p + 48);
+		e->typeflag = (char)p[52];
+
+		if (offs[2 * i] >= off
+		    || (offs[2 * i + 1] != (size_t)-1 && offs[2 * i + 1] >= off))
+		{
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	/* entries were saved in sorted order */
+	index_finish(*idx, offs, 0);
+
+	free(offs);
+	free(buf);
+	fclose(f);
+	return 0;
+
+  fail:
+	free(offs);
+	free(buf);
+	fclose(f);
+	if (*idx != NULL)
+		tar_index_free(*idx);
+	*idx = NULL;
+	return -1;
+}
+
+
+ssize_t
+tar_index_pread(int archive_fd, const tar_index_entry_t *e, void *buf,
+		size_t count, off_t offset)
+{
+	/* only the packed data runs of a sparse file are archived */
+	if (offset < 0 || e->typeflag == GNU_SPARSE_TYPE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (offset >= e->size)
+		return 0;
+	if ((off_t)count > e->size - offset)
+		count = (size_t)(e->size - offset);
+
+	return pread(archive_fd, buf, count, e->data_offset + offset);
+}
+
+
+void
+tar_index_free(tar_index_t *idx)
+{
+	free(idx->entries);
+	free(idx->strings);
+	free(idx);
+}
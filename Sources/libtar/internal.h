@@ -21,3 +21,224 @@
 #define TLS_THREAD
 #endif
 
+
+
+/***** handle.c ************************************************************/
+
+/*
+** return one of the handle's scratch buffers (TAR_SCRATCH_*), grown to
+** at least size bytes; its contents are preserved, but it may move
+*/
+char *tar_scratch(TAR *t, int slot, size_t size);
+
+
+/***** decode.c ************************************************************/
+
+/* the archived size straight from th_buf, for use before th_decode() */
+#define th_hdr_size(t) (((t)->th_buf.pax.flags & TAR_PAX_SIZE) \
+			? (t)->th_buf.pax.size \
+			: (off_t)th_get_field((t), size))
+
+
+/***** append.c ************************************************************/
+
+/* the (dev, ino) table of multiply-linked files kept in t->h on append */
+struct tar_ino;
+unsigned int tar_ino_hash(struct tar_ino *ti, unsigned int numbuckets);
+int tar_ino_match(struct tar_ino *key, struct tar_ino *ti);
+
+
+/***** block.c *************************************************************/
+
+/*
+** consume up to len bytes (rounded up to a whole block) from the read-ahead
+** buffer without copying them; *ptr is set to the first byte
+** returns the number of bytes consumed (a multiple of T_BLOCKSIZE),
+** 0 at EOF or on a truncated block, or -1 (and sets errno) on error
+*/
+ssize_t tar_block_next(TAR *t, size_t len, char **ptr);
+
+/*
+** consume len bytes (a multiple of T_BLOCKSIZE), seeking over whatever
+** isn't buffered when the tartype_t allows it
+** returns 0 on success, or -1 (and sets errno) on error or early EOF
+*/
+int tar_block_skip(TAR *t, off_t len);
+
+/*
+** make room for at least one block at the end of the output buffer;
+** *ptr is set to the first free byte, and t->wbuflen is advanced by
+** however much of it gets filled
+** returns the number of free bytes, or -1 (and sets errno) on error
+*/
+ssize_t tar_block_space(TAR *t, char **ptr);
+
+/* append a run of data to the sparse map of the current header */
+int th_sparse_add(TAR *t, off_t offset, off_t numbytes);
+
+/*
+** append a "len key=value\n" record to the PAX extended header being
+** built in the handle's PAX scratch buffer, which holds *len bytes so far
+*/
+int th_pax_record(TAR *t, size_t *len, const char *key, const char *value);
+
+/* write a PAX extended header holding the first len bytes of records */
+int th_write_pax(TAR *t, size_t len);
+
+
+/***** extract.c ***********************************************************/
+
+/* file metadata decoded from a header, for use away from the TAR handle */
+struct tar_meta
+{
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	struct timespec times[2];	/* atime, mtime */
+	int issym;
+	int chown;		/* set the owner too (we're root) */
+};
+
+void th_get_meta(TAR *t, struct tar_meta *m);
+
+/*
+** set owner, times and mode of name in the directory dirfd (or AT_FDCWD);
+** safe to call from any thread
+*/
+int tar_apply_meta(int dirfd, const char *name, const struct tar_meta *m);
+
+/* the same, for a file that's still open */
+int tar_apply_fmeta(int fd, const struct tar_meta *m);
+
+/*
+** with TAR_SKIP_UNCHANGED, check whether name in dirfd already matches
+** the current regfile and skip its contents if so
+** returns 1 if it was skipped, 0 if it must be extracted, or -1 (and
+** sets errno) on error
+*/
+int tar_extract_unchanged(TAR *t, int dirfd, const char *name,
+			  char *realname, const struct tar_meta *m);
+
+/*
+** create or truncate base in dirfd for writing, replacing a symlink
+** with TAR_RESOLVE_BENEATH
+*/
+int tar_extract_open(TAR *t, int dirfd, const char *base);
+
+/*
+** reserve disk space for len bytes at offset in fd (TAR_PREALLOCATE);
+** fails only when that space isn't there; safe to call from any thread
+*/
+int tar_preallocate(int fd, off_t offset, off_t len);
+
+/* remember where the current entry was extracted, for hardlinks to it */
+int tar_extract_remember(TAR *t, char *realname);
+
+/* map a hardlink target to the name it was extracted as */
+char *tar_extract_linktarget(TAR *t, char *linkname);
+
+/*
+** create filename as a hardlink to the entry extracted for linkname, and
+** give it the metadata in m unless that's NULL
+*/
+int tar_extract_linkto(TAR *t, char *linkname, char *filename,
+		       const struct tar_meta *m);
+
+
+/***** stream.c ************************************************************/
+
+/*
+** mark the contents of the current regfile as consumed, for code that
+** reads them straight from the read-ahead buffer instead of the cursor
+*/
+void tar_cursor_end(TAR *t);
+
+
+/***** dedup.c *************************************************************/
+
+/* t->nokcopy bit: file clones don't work here (the others are in extract.c) */
+#define KCOPY_NO_CLONE		4
+
+/* initial value for tar_dedup_hash() */
+#define TAR_DEDUP_SEED		0xcbf29ce484222325ULL
+
+/* continue the hash of a payload with its next len bytes */
+uint64_t tar_dedup_hash(uint64_t h, const char *buf, size_t len);
+
+/* record a payload of size bytes that has been written to realname */
+int tar_dedup_add(TAR *t, uint64_t hash, off_t size, const char *realname,
+		  const struct tar_meta *m);
+
+/*
+** extract the payload in buf as a clone of (or hardlink to) a file that
+** holds the same bytes, if there is one
+** returns 1 if it was extracted, 0 if it has to be written, or -1 (and
+** sets errno) on error
+*/
+int tar_dedup_extract(TAR *t, uint64_t hash, const char *buf, off_t size,
+		      char *filename, const struct tar_meta *m);
+
+
+/***** idcache.c ***********************************************************/
+
+/*
+** map owner names to ids and back, remembering every answer for the
+** life of the handle; a name that isn't found returns 0 (or NULL)
+*/
+int tar_id_uid(TAR *t, const char *name, uid_t *uid);
+int tar_id_gid(TAR *t, const char *name, gid_t *gid);
+const char *tar_id_uname(TAR *t, uid_t uid);
+const char *tar_id_gname(TAR *t, gid_t gid);
+
+
+/***** dircache.c **********************************************************/
+
+/*
+** start a new extraction: apply what's left of the last one, forget the
+** cached directories and, with TAR_RESOLVE_BENEATH, create and open root
+** (may be NULL for the current directory), beneath which every extracted
+** path must then stay
+*/
+int tar_dir_root(TAR *t, const char *root);
+
+/*
+** return a descriptor for the parent directory of path, creating any
+** missing directories, and copy the last component of path to base;
+** the descriptor belongs to the cache and is only valid until the next
+** call, and paths leaving the root fail with EXDEV
+*/
+int tar_dir_parent(TAR *t, const char *path, char *base, size_t basesize);
+
+/*
+** hold back the mode, owner and times of an extracted directory until
+** tar_dir_finish(), which applies them to the deepest directories first
+*/
+int tar_dir_defer(TAR *t, const char *path, const struct tar_meta *m);
+int tar_dir_finish(TAR *t);
+
+/*
+** apply any pending directory metadata and close all cached directories;
+** returns -1 if any of that metadata could not be applied
+*/
+int tar_dir_close(TAR *t);
+
+
+/***** arena.c *************************************************************/
+
+/* allocate size bytes that live until tar_close() */
+void *tar_arena_alloc(TAR *t, size_t size);
+
+/* copy a string into the arena */
+char *tar_arena_strdup(TAR *t, const char *s);
+
+/* release everything allocated with tar_arena_alloc() */
+void tar_arena_free(TAR *t);
+
+
+/***** util.c **************************************************************/
+
+/*
+** compare the header's checksum against block sums from tar_block_sum(),
+** accepting either the unsigned or the signed variant
+*/
+int th_crc_match(TAR *t, int usum, int ssum);
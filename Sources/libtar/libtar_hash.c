@@ -19,20 +19,83 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifdef STDC_HEADERS
 # include <stdlib.h>
+# include <string.h>
 #endif
 
 
+/* marks a slot whose entry was deleted, so that probing goes on past it */
+static char libtar_hash_deleted;
+#define HASH_DELETED	((void *)&libtar_hash_deleted)
+
+#define HASH_MINSIZE	16
+
+
+/* home slot of a hash value: Fibonacci hashing mixes in the high bits */
+#define HASH_SLOT(h, hv) \
+	((int)(((hv) * 2654435769U) >> (h)->shift))
+
+
+/* allocate an empty table of num slots (a power of two) */
+static int
+libtar_hash_alloc(libtar_hash_t *h, int num)
+{
+	int shift;
+
+	h->table = (struct libtar_hashslot *)calloc(num,
+					sizeof(struct libtar_hashslot));
+	if (h->table == NULL)
+		return -1;
+	for (shift = 32; num > 1; num >>= 1)
+		shift--;
+	h->numbuckets = 1 << (32 - shift);
+	h->shift = shift;
+	h->nused = h->nents;
+
+	return 0;
+}
+
+
+/* move every entry to a table of num slots, dropping deleted slots */
+static int
+libtar_hash_resize(libtar_hash_t *h, int num)
+{
+	struct libtar_hashslot *old = h->table;
+	int oldnum = h->numbuckets;
+	int i, j;
+
+	if (libtar_hash_alloc(h, num) == -1)
+	{
+		h->table = old;
+		return -1;
+	}
+
+	for (i = 0; i < oldnum; i++)
+	{
+		if (old[i].data == NULL || old[i].data == HASH_DELETED)
+			continue;
+		for (j = HASH_SLOT(h, old[i].hash); h->table[j].data != NULL;
+		     j = (j + 1) & (h->numbuckets - 1))
+			;
+		h->table[j] = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+
 /*
 ** libtar_hashptr_reset() - reset a hash pointer
 */
 void
 libtar_hashptr_reset(libtar_hashptr_t *hp)
 {
-	libtar_listptr_reset(&(hp->node));
 	hp->bucket = -1;
+	hp->data = NULL;
 }
 
 
@@ -42,34 +105,28 @@ libtar_hashptr_reset(libtar_hashptr_t *hp)
 void *
 libtar_hashptr_data(libtar_hashptr_t *hp)
 {
-	return libtar_listptr_data(&(hp->node));
+	return hp->data;
 }
 
 
 /*
-** libtar_str_hashfunc() - default hash function, optimized for
-**				      7-bit strings
+** libtar_str_hashfunc() - default hash function (FNV-1a)
 */
 unsigned int
 libtar_str_hashfunc(char *key, unsigned int num_buckets)
 {
-#if 0
-	register unsigned result = 0;
-	register int i;
+	unsigned int result = 2166136261U;
 
 	if (key == NULL)
 		return 0;
 
-	for (i = 0; *key != '\0' && i < 32; i++)
-		result = result * 33U + *key++;
+	while (*key != '\0')
+	{
+		result ^= (unsigned char)*key++;
+		result *= 16777619U;
+	}
 
 	return (result % num_buckets);
-#else
-	if (key == NULL)
-		return 0;
-
-	return (key[0] % num_buckets);
-#endif
 }
 
 
@@ -85,23 +142,25 @@ libtar_hash_nents(libtar_hash_t *h)
 
 /*
 ** libtar_hash_new() - create a new hash
+** num is a hint for the number of entries; the table grows as needed
 */
 libtar_hash_t *
 libtar_hash_new(int num, libtar_hashfunc_t hashfunc)
 {
 	libtar_hash_t *hash;
+	int size;
 
 	hash = (libtar_hash_t *)calloc(1, sizeof(libtar_hash_t));
 	if (hash == NULL)
 		return NULL;
-	hash->numbuckets = num;
 	if (hashfunc != NULL)
 		hash->hashfunc = hashfunc;
 	else
 		hash->hashfunc = (libtar_hashfunc_t)libtar_str_hashfunc;
 
-	hash->table = (libtar_list_t **)calloc(num, sizeof(libtar_list_t *));
-	if (hash->table == NULL)
+	for (size = HASH_MINSIZE; size < num && size < (1 << 30); size <<= 1)
+		;
+	if (libtar_hash_alloc(hash, size) == -1)
 	{
 		free(hash);
 		return NULL;
@@ -123,59 +182,22 @@ libtar_hash_next(libtar_hash_t *h,
 {
 #ifdef DS_DEBUG
 	printf("==> libtar_hash_next(h=0x%lx, hp={%d,0x%lx})\n",
-	       h, hp->bucket, hp->node);
-#endif
-
-	if (hp->bucket >= 0 && hp->node != NULL &&
-	    libtar_list_next(h->table[hp->bucket], &(hp->node)) != 0)
-	{
-#ifdef DS_DEBUG
-		printf("    libtar_hash_next(): found additional "
-		       "data in current bucket (%d), returing 1\n",
-		       hp->bucket);
-#endif
-		return 1;
-	}
-
-#ifdef DS_DEBUG
-	printf("    libtar_hash_next(): done with bucket %d\n",
-	       hp->bucket);
+	       h, hp->bucket, hp->data);
 #endif
 
 	for (hp->bucket++; hp->bucket < h->numbuckets; hp->bucket++)
 	{
-#ifdef DS_DEBUG
-		printf("    libtar_hash_next(): "
-		       "checking bucket %d\n", hp->bucket);
-#endif
-		hp->node = NULL;
-		if (h->table[hp->bucket] != NULL &&
-		    libtar_list_next(h->table[hp->bucket],
-		    				&(hp->node)) != 0)
-		{
-#ifdef DS_DEBUG
-			printf("    libtar_hash_next(): "
-			       "found data in bucket %d, returing 1\n",
-			       hp->bucket);
-#endif
+		hp->data = h->table[hp->bucket].data;
+		if (hp->data != NULL && hp->data != HASH_DELETED)
 			return 1;
-		}
-	}
-
-	if (hp->bucket == h->numbuckets)
-	{
-#ifdef DS_DEBUG
-		printf("    libtar_hash_next(): hash pointer "
-		       "wrapped to 0\n");
-#endif
-		hp->bucket = -1;
-		hp->node = NULL;
 	}
 
 #ifdef DS_DEBUG
 	printf("<== libtar_hash_next(): no more data, "
 	       "returning 0\n");
 #endif
+	hp->bucket = -1;
+	hp->data = NULL;
 	return 0;
 }
 
@@ -192,14 +214,16 @@ libtar_hash_del(libtar_hash_t *h,
 {
 	if (hp->bucket < 0
 	    || hp->bucket >= h->numbuckets
-	    || h->table[hp->bucket] == NULL
-	    || hp->node == NULL)
+	    || h->table[hp->bucket].data != hp->data
+	    || hp->data == NULL
+	    || hp->data == HASH_DELETED)
 	{
 		errno = EINVAL;
 		return -1;
 	}
 
-	libtar_list_del(h->table[hp->bucket], &(hp->node));
+	/* the slot stays in use, so iterations and probes aren't disturbed */
+	h->table[hp->bucket].data = HASH_DELETED;
 	h->nents--;
 	return 0;
 }
@@ -214,10 +238,15 @@ libtar_hash_empty(libtar_hash_t *h, libtar_freefunc_t freefunc)
 	int i;
 
 	for (i = 0; i < h->numbuckets; i++)
-		if (h->table[i] != NULL)
-			libtar_list_empty(h->table[i], freefunc);
+	{
+		if (freefunc != NULL && h->table[i].data != NULL
+		    && h->table[i].data != HASH_DELETED)
+			(*freefunc)(h->table[i].data);
+		h->table[i].data = NULL;
+	}
 
 	h->nents = 0;
+	h->nused = 0;
 }
 
 
@@ -227,12 +256,7 @@ libtar_hash_empty(libtar_hash_t *h, libtar_freefunc_t freefunc)
 void
 libtar_hash_free(libtar_hash_t *h, libtar_freefunc_t freefunc)
 {
-	int i;
-
-	for (i = 0; i < h->numbuckets; i++)
-		if (h->table[i] != NULL)
-			libtar_list_free(h->table[i], freefunc);
-
+	libtar_hash_empty(h, freefunc);
 	free(h->table);
 	free(h);
 }
@@ -250,7 +274,7 @@ libtar_hash_search(libtar_hash_t *h,
 			      libtar_matchfunc_t matchfunc)
 {
 	while (libtar_hash_next(h, hp) != 0)
-		if ((*matchfunc)(data, libtar_listptr_data(&(hp->node))) != 0)
+		if ((*matchfunc)(data, hp->data) != 0)
 			return 1;
 
 	return 0;
@@ -258,7 +282,8 @@ libtar_hash_search(libtar_hash_t *h,
 
 
 /*
-** libtar_hash_getkey() - hash-based search for an element in a hash
+** libtar_hash_getkey() - hash-based search for an element in a hash;
+** a pointer left on a match continues with the next entry for the key
 ** returns:
 **	1			match found
 **	0			no match
@@ -268,37 +293,36 @@ libtar_hash_getkey(libtar_hash_t *h,
 			      libtar_hashptr_t *hp, void *key,
 			      libtar_matchfunc_t matchfunc)
 {
+	unsigned int hv;
+	int i, mask = h->numbuckets - 1;
+	void *data;
+
 #ifdef DS_DEBUG
 	printf("==> libtar_hash_getkey(h=0x%lx, hp={%d,0x%lx}, "
 	       "key=0x%lx, matchfunc=0x%lx)\n",
-	       h, hp->bucket, hp->node, key, matchfunc);
+	       h, hp->bucket, hp->data, key, matchfunc);
 #endif
 
-	if (hp->bucket == -1)
-	{
-		hp->bucket = (*(h->hashfunc))(key, h->numbuckets);
-#ifdef DS_DEBUG
-		printf("    libtar_hash_getkey(): hp->bucket "
-		       "set to %d\n", hp->bucket);
-#endif
-	}
+	hv = (*(h->hashfunc))(key, UINT_MAX);
+	i = (hp->bucket == -1 ? HASH_SLOT(h, hv) : ((hp->bucket + 1) & mask));
 
-	if (h->table[hp->bucket] == NULL)
+	/* the table is never full, so there's always an empty slot */
+	for (; (data = h->table[i].data) != NULL; i = (i + 1) & mask)
 	{
-#ifdef DS_DEBUG
-		printf("    libtar_hash_getkey(): no list "
-		       "for bucket %d, returning 0\n", hp->bucket);
-#endif
-		hp->bucket = -1;
-		return 0;
+		if (data == HASH_DELETED || h->table[i].hash != hv
+		    || (*matchfunc)(key, data) == 0)
+			continue;
+		hp->bucket = i;
+		hp->data = data;
+		return 1;
 	}
 
 #ifdef DS_DEBUG
-	printf("<== libtar_hash_getkey(): "
-	       "returning libtar_list_search()\n");
+	printf("<== libtar_hash_getkey(): no match, returning 0\n");
 #endif
-	return libtar_list_search(h->table[hp->bucket], &(hp->node),
-					     key, matchfunc);
+	hp->bucket = -1;
+	hp->data = NULL;
+	return 0;
 }
 
 
@@ -311,34 +335,35 @@ libtar_hash_getkey(libtar_hash_t *h,
 int
 libtar_hash_add(libtar_hash_t *h, void *data)
 {
-	int bucket, i;
+	unsigned int hv;
+	int i, num;
 
 #ifdef DS_DEBUG
 	printf("==> libtar_hash_add(h=0x%lx, data=0x%lx)\n",
 	       h, data);
 #endif
 
-	bucket = (*(h->hashfunc))(data, h->numbuckets);
-#ifdef DS_DEBUG
-	printf("    libtar_hash_add(): inserting in bucket %d\n",
-	       bucket);
-#endif
-	if (h->table[bucket] == NULL)
+	/* keep the load factor (counting deleted slots) under 3/4 */
+	if ((h->nused + 1) * 4 > (unsigned int)h->numbuckets * 3)
 	{
-#ifdef DS_DEBUG
-		printf("    libtar_hash_add(): creating new list\n");
-#endif
-		h->table[bucket] = libtar_list_new(LIST_QUEUE, NULL);
+		num = h->numbuckets;
+		if ((h->nents + 1) * 2 > (unsigned int)num)
+			num *= 2;
+		if (num > (1 << 30) || libtar_hash_resize(h, num) == -1)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
 	}
 
-#ifdef DS_DEBUG
-	printf("<== libtar_hash_add(): "
-	       "returning libtar_list_add()\n");
-#endif
-	i = libtar_list_add(h->table[bucket], data);
-	if (i == 0)
-		h->nents++;
-	return i;
-}
-
+	hv = (*(h->hashfunc))(data, UINT_MAX);
+	for (i = HASH_SLOT(h, hv); h->table[i].data != NULL;
+	     i = (i + 1) & (h->numbuckets - 1))
+		;
+	h->table[i].hash = hv;
+	h->table[i].data = data;
+	h->nents++;
+	h->nused++;
 
+	return 0;
+}
@@ -63,8 +63,7 @@ void
 th_print_long_ls(TAR *t)
 {
 	char modestring[12];
-	struct passwd *pw;
-	struct group *gr;
+	const char *name;
 	uid_t uid;
 	gid_t gid;
 	char username[_POSIX_LOGIN_NAME_MAX];
@@ -82,26 +81,26 @@ th_print_long_ls(TAR *t)
 #endif
 
 	uid = th_get_uid(t);
-	pw = getpwuid(uid);
-	if (pw == NULL)
+	name = ((t->options & TAR_NUMERIC_OWNER) ? NULL : tar_id_uname(t, uid));
+	if (name == NULL)
 		snprintf(username, sizeof(username), "%d", uid);
 	else
-		strlcpy(username, pw->pw_name, sizeof(username));
+		strlcpy(username, name, sizeof(username));
 
 	gid = th_get_gid(t);
-	gr = getgrgid(gid);
-	if (gr == NULL)
+	name = ((t->options & TAR_NUMERIC_OWNER) ? NULL : tar_id_gname(t, gid));
+	if (name == NULL)
 		snprintf(groupname, sizeof(groupname), "%d", gid);
 	else
-		strlcpy(groupname, gr->gr_name, sizeof(groupname));
+		strlcpy(groupname, name, sizeof(groupname));
 
 	strmode(th_get_mode(t), modestring);
 	printf("%.10s %-8.8s %-8.8s ", modestring, username, groupname);
 
 	if (TH_ISCHR(t) || TH_ISBLK(t))
-		printf(" %3d, %3d ", th_get_devmajor(t), th_get_devminor(t));
+		printf(" %3lu, %3lu ", th_get_devmajor(t), th_get_devminor(t));
 	else
-		printf("%9ld ", (long)th_get_size(t));
+		printf("%9lld ", (long long)th_get_realsize(t));
 
 	mtime = th_get_mtime(t);
 	mtm = localtime(&mtime);
@@ -122,10 +121,7 @@ th_print_long_ls(TAR *t)
 			printf(" -> ");
 		else
 			printf(" link to ");
-		if ((t->options & TAR_GNU) && t->th_buf.gnu_longlink != NULL)
-			printf("%s", t->th_buf.gnu_longlink);
-		else
-			printf("%.100s", t->th_buf.linkname);
+		printf("%s", th_get_linkname(t));
 	}
 
 	putchar('\n');
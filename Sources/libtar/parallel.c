@@ -0,0 +1,787 @@
+/*
+**  parallel.c - libtar code to extract an archive with worker threads
+**
+**  The calling thread reads headers and payloads; regular files are
+**  handed to a pool of workers that create, write and close them, which
+**  is where the time goes for archives of many small files.  A file is
+**  always given to the worker picked by a hash of its path, so entries
+**  for the same path are written in archive order.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+
+/* memory charged to every queued file on top of its payload */
+#define PJOB_OVERHEAD		4096
+
+/* files bigger than this are written by the reading thread */
+#define PJOB_MAXSIZE		(TAR_PARALLEL_INFLIGHT / 4)
+
+/* descriptors left to the directory cache before any go to queued jobs */
+#define PJOB_FDRESERVE		64
+
+
+/* a parent directory held open for the jobs queued to write into it */
+struct pdir
+{
+	char *path;
+	int fd;
+	int refs;		/* jobs using it */
+};
+
+/* a regular file handed to a worker */
+struct pjob
+{
+	struct pjob *next;
+	struct pdir *dir;	/* parent directory */
+	char *filename;		/* name within it */
+	int oflags;
+	int prealloc;		/* TAR_PREALLOCATE */
+	const char *data;	/* payload */
+	char *buf;		/* allocation behind data, NULL for a mapping */
+	size_t size;
+	size_t cost;		/* what it counts against the in-flight limit */
+	struct tar_meta meta;
+};
+
+/* a hardlink, created once all files are written */
+struct plink
+{
+	struct plink *next;
+	char *filename;
+	char *linkname;		/* target as found in the archive */
+	struct tar_meta meta;
+};
+
+struct pextract;
+
+struct pworker
+{
+	pthread_t thread;
+	pthread_cond_t cond;	/* signalled when a job is queued */
+	struct pjob *head, *tail;
+	int busy;
+	struct pextract *p;
+};
+
+struct pextract
+{
+	pthread_mutex_t lock;
+	pthread_cond_t space;	/* signalled whenever a job finishes */
+	size_t inflight;	/* bytes reserved by queued or running jobs */
+	size_t njobs;		/* queued or running jobs */
+	size_t maxjobs;		/* limit on njobs, from RLIMIT_NOFILE */
+	libtar_hash_t *dirs;	/* struct pdir in use, by path */
+	int err;		/* errno of the first failure, or 0 */
+	int done;		/* no more jobs will be queued */
+	struct pworker *workers;
+	int nworkers;
+	struct plink *links;	/* hardlinks queued, in archive order */
+	struct plink **linktail;
+	libtar_hash_t *linknames;	/* their filenames */
+};
+
+
+static unsigned int
+pdir_hashfunc(struct pdir *d, unsigned int numbuckets)
+{
+	return libtar_str_hashfunc(d->path, numbuckets);
+}
+
+
+static int
+pdir_match(struct pdir *key, struct pdir *d)
+{
+	return (strcmp(key->path, d->path) == 0);
+}
+
+
+/*
+** find or open the parent directory shared by the jobs for path, whose
+** descriptor from tar_dir_parent() is dirfd; call with p->lock held
+*/
+static struct pdir *
+pdir_get(struct pextract *p, const char *path, int dirfd)
+{
+	libtar_hashptr_t hp;
+	struct pdir key, *d;
+	const char *slash;
+
+	slash = strrchr(path, '/');
+	key.path = strndup(path, (slash != NULL ? (size_t)(slash - path) : 0));
+	if (key.path == NULL)
+		return NULL;
+
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(p->dirs, &hp, &key,
+			       (libtar_matchfunc_t)pdir_match) != 0)
+	{
+		free(key.path);
+		d = (struct pdir *)libtar_hashptr_data(&hp);
+		d->refs++;
+		return d;
+	}
+
+	d = (struct pdir *)malloc(sizeof(struct pdir));
+	if (d == NULL)
+	{
+		free(key.path);
+		return NULL;
+	}
+	d->path = key.path;
+	d->refs = 1;
+	d->fd = (dirfd == AT_FDCWD ? AT_FDCWD : dup(dirfd));
+	if (d->fd == -1 || libtar_hash_add(p->dirs, d) == -1)
+	{
+		if (d->fd >= 0)
+			close(d->fd);
+		free(d->path);
+		free(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+
+/* drop a job's hold on its directory; call with p->lock held */
+static void
+pdir_put(struct pextract *p, struct pdir *d)
+{
+	libtar_hashptr_t hp;
+
+	if (--d->refs > 0)
+		return;
+
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(p->dirs, &hp, d,
+			       (libtar_matchfunc_t)pdir_match) != 0)
+		libtar_hash_del(p->dirs, &hp);
+	if (d->fd >= 0)
+		close(d->fd);
+	free(d->path);
+	free(d);
+}
+
+
+/* call with p->lock held */
+static void
+pjob_free(struct pextract *p, struct pjob *j)
+{
+	if (j->dir != NULL)
+		pdir_put(p, j->dir);
+	free(j->filename);
+	free(j->buf);
+	free(j);
+}
+
+
+/* create and write one file; runs on a worker thread */
+static int
+pjob_run(struct pjob *j)
+{
+	const char *ptr = j->data;
+	size_t left = j->size;
+	ssize_t k;
+	int fd;
+
+	fd = openat(j->dir->fd, j->filename, j->oflags, 0666);
+	if (fd == -1 && errno == ELOOP && (j->oflags & O_NOFOLLOW))
+	{
+		/* replace a symlink rather than write through it */
+		if (unlinkat(j->dir->fd, j->filename, 0) == 0)
+			fd = openat(j->dir->fd, j->filename, j->oflags, 0666);
+	}
+	if (fd == -1)
+		return -1;
+
+	/* fail now rather than half way through a file that can't fit */
+	if (j->prealloc && j->size > 0
+	    && tar_preallocate(fd, 0, (off_t)j->size) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	while (left > 0)
+	{
+		k = write(fd, ptr, left);
+		if (k == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		ptr += k;
+		left -= k;
+	}
+
+	if (tar_apply_fmeta(fd, &(j->meta)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+
+static void *
+pworker_main(void *arg)
+{
+	struct pworker *w = (struct pworker *)arg;
+	struct pextract *p = w->p;
+	struct pjob *j;
+	int rv;
+
+	pthread_mutex_lock(&(p->lock));
+	for (;;)
+	{
+		while (w->head == NULL && !p->done)
+			pthread_cond_wait(&(w->cond), &(p->lock));
+		j = w->head;
+		if (j == NULL)
+			break;
+		w->head = j->next;
+		if (w->head == NULL)
+			w->tail = NULL;
+
+		/* after a failure, queued jobs are only freed */
+		rv = 0;
+		if (p->err == 0)
+		{
+			w->busy = 1;
+			pthread_mutex_unlock(&(p->lock));
+			rv = (pjob_run(j) == 0 ? 0 : (errno ? errno : EIO));
+			pthread_mutex_lock(&(p->lock));
+			w->busy = 0;
+		}
+		if (rv != 0 && p->err == 0)
+			p->err = rv;
+
+		p->inflight -= j->cost;
+		p->njobs--;
+		pthread_cond_signal(&(p->space));
+		pjob_free(p, j);
+	}
+	pthread_mutex_unlock(&(p->lock));
+
+	return NULL;
+}
+
+
+/* wait until a worker has nothing queued or running */
+static int
+pextract_wait_idle(struct pextract *p, struct pworker *w)
+{
+	int err;
+
+	pthread_mutex_lock(&(p->lock));
+	while (w->head != NULL || w->busy)
+		pthread_cond_wait(&(p->space), &(p->lock));
+	err = p->err;
+	pthread_mutex_unlock(&(p->lock));
+
+	if (err != 0)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+** wait until a job of cost bytes can be queued without going over the
+** limits on bytes and jobs in flight
+*/
+static int
+pextract_reserve(struct pextract *p, size_t cost)
+{
+	int err;
+
+	pthread_mutex_lock(&(p->lock));
+	while (p->njobs > 0 && p->err == 0
+	       && (p->inflight + cost > TAR_PARALLEL_INFLIGHT
+		   || p->njobs >= p->maxjobs))
+		pthread_cond_wait(&(p->space), &(p->lock));
+	err = p->err;
+	if (err == 0)
+	{
+		p->inflight += cost;
+		p->njobs++;
+	}
+	pthread_mutex_unlock(&(p->lock));
+
+	if (err != 0)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+static void
+pextract_release(struct pextract *p, size_t cost)
+{
+	pthread_mutex_lock(&(p->lock));
+	p->inflight -= cost;
+	p->njobs--;
+	pthread_mutex_unlock(&(p->lock));
+}
+
+
+static void
+pextract_queue(struct pextract *p, struct pworker *w, struct pjob *j)
+{
+	pthread_mutex_lock(&(p->lock));
+	if (w->tail != NULL)
+		w->tail->next = j;
+	else
+		w->head = j;
+	w->tail = j;
+	pthread_cond_signal(&(w->cond));
+	pthread_mutex_unlock(&(p->lock));
+}
+
+
+/*
+** how many jobs can be queued at once: each may hold its parent directory
+** open, and each running one the file it writes, so half of what the
+** directory cache and the workers leave of RLIMIT_NOFILE goes to them
+*/
+static size_t
+pextract_maxjobs(int nworkers)
+{
+	struct rlimit rl;
+	rlim_t n = 65536;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+	    && rl.rlim_cur < n)
+		n = rl.rlim_cur;
+	if (n <= PJOB_FDRESERVE + (rlim_t)nworkers)
+		return 1;
+	return (size_t)((n - PJOB_FDRESERVE - nworkers) / 2);
+}
+
+
+/* FNV-1a, to spread paths over the workers */
+static unsigned int
+pextract_hash(const char *path)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *path != '\0'; path++)
+	{
+		h ^= (unsigned char)*path;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+
+/* read the payload of the current regfile for a job */
+static int
+pjob_read(TAR *t, struct pjob *j)
+{
+	size_t len, left;
+	ssize_t k;
+	char *ptr, *dst;
+
+	if (j->size == 0)
+	{
+		j->data = "";
+		return 0;
+	}
+
+	/* a mapping stays valid until tar_close(), so point into it */
+	if (t->map != NULL)
+	{
+		k = tar_block_next(t, j->size, &ptr);
+		if (k < 0)
+			return -1;
+		if ((size_t)k < j->size)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		j->data = ptr;
+		tar_cursor_end(t);
+		return 0;
+	}
+
+	j->buf = (char *)malloc(j->size);
+	if (j->buf == NULL)
+		return -1;
+	for (dst = j->buf, left = j->size; left > 0; dst += len, left -= len)
+	{
+		k = tar_block_next(t, left, &ptr);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		len = ((size_t)k > left ? left : (size_t)k);
+		memcpy(dst, ptr, len);
+		t->cursor.left -= len;
+	}
+	j->data = j->buf;
+	tar_cursor_end(t);
+
+	return 0;
+}
+
+
+/*
+** hand the current regfile to a worker; its parent directories are
+** created here, and the worker gets a descriptor for the parent that's
+** shared with the other jobs queued for the same directory
+*/
+static int
+pextract_regfile(TAR *t, struct pextract *p, struct pworker *w,
+		 char *realname)
+{
+	char base[MAXPATHLEN];
+	struct tar_meta m;
+	struct pjob *j;
+	size_t cost;
+	int dirfd, i;
+
+	dirfd = tar_dir_parent(t, realname, base, sizeof(base));
+	if (dirfd == -1)
+		return -1;
+
+	th_get_meta(t, &m);
+	i = tar_extract_unchanged(t, dirfd, base, realname, &m);
+	if (i != 0)
+		return (i == 1 ? 0 : -1);
+
+	cost = (t->map != NULL ? 0 : (size_t)th_get_size(t)) + PJOB_OVERHEAD;
+	if (pextract_reserve(p, cost) == -1)
+		return -1;
+
+	j = (struct pjob *)calloc(1, sizeof(struct pjob));
+	if (j == NULL)
+	{
+		pextract_release(p, cost);
+		return -1;
+	}
+	j->cost = cost;
+	j->size = (size_t)th_get_size(t);
+	j->meta = m;
+	j->oflags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_BINARY
+	j->oflags |= O_BINARY;
+#endif
+	if (t->options & TAR_RESOLVE_BENEATH)
+		j->oflags |= O_NOFOLLOW;
+	j->prealloc = ((t->options & TAR_PREALLOCATE) != 0);
+	pthread_mutex_lock(&(p->lock));
+	j->dir = pdir_get(p, realname, dirfd);
+	pthread_mutex_unlock(&(p->lock));
+	j->filename = strdup(base);
+	if (j->dir == NULL || j->filename == NULL || pjob_read(t, j) == -1)
+	{
+		pthread_mutex_lock(&(p->lock));
+		pjob_free(p, j);
+		pthread_mutex_unlock(&(p->lock));
+		pextract_release(p, cost);
+		return -1;
+	}
+
+	pextract_queue(p, w, j);
+	return 0;
+}
+
+
+/* queue a hardlink until everything it could point at is written */
+static int
+pextract_hardlink(TAR *t, struct pextract *p, char *realname)
+{
+	struct plink *l;
+
+	if (p->linknames == NULL)
+	{
+		p->linknames = libtar_hash_new(256,
+				(libtar_hashfunc_t)libtar_str_hashfunc);
+		if (p->linknames == NULL)
+			return -1;
+	}
+
+	l = (struct plink *)calloc(1, sizeof(struct plink));
+	if (l == NULL)
+		return -1;
+	l->filename = strdup(realname);
+	l->linkname = strdup(th_get_linkname(t));
+	th_get_meta(t, &(l->meta));
+	*(p->linktail) = l;
+	p->linktail = &(l->next);
+
+	if (l->filename == NULL || l->linkname == NULL)
+		return -1;
+	return libtar_hash_add(p->linknames, l->filename);
+}
+
+
+/* is a hardlink to be created at path still queued? */
+static int
+pextract_link_queued(struct pextract *p, char *path)
+{
+	libtar_hashptr_t hp;
+
+	if (p->linknames == NULL)
+		return 0;
+	libtar_hashptr_reset(&hp);
+	return (libtar_hash_getkey(p->linknames, &hp, path,
+				   (libtar_matchfunc_t)libtar_str_match) != 0);
+}
+
+
+/*
+** for TAR_NOOVERWRITE: is there something at path already, on disk or
+** handed to a worker or the hardlink queue but maybe not written yet?
+*/
+static int
+pextract_exists(TAR *t, struct pextract *p, char *path)
+{
+	libtar_hashptr_t hp;
+	struct stat s;
+
+	if (lstat(path, &s) == 0 || errno != ENOENT)
+		return 1;
+
+	/* t->h holds every entry extracted through t, written or not */
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(t->h, &hp, th_get_pathname(t),
+			       (libtar_matchfunc_t)libtar_str_match) != 0)
+		return 1;
+
+	return pextract_link_queued(p, path);
+}
+
+
+static void
+pextract_links_free(struct pextract *p)
+{
+	struct plink *l;
+
+	while ((l = p->links) != NULL)
+	{
+		p->links = l->next;
+		free(l->filename);
+		free(l->linkname);
+		free(l);
+	}
+	p->linktail = &(p->links);
+	if (p->linknames != NULL)
+		libtar_hash_empty(p->linknames, NULL);
+}
+
+
+/* create the queued hardlinks, once every file queued so far is written */
+static int
+pextract_links(TAR *t, struct pextract *p)
+{
+	struct plink *l;
+	int n, rv = 0;
+
+	for (n = 0; n < p->nworkers && rv == 0; n++)
+		rv = pextract_wait_idle(p, &(p->workers[n]));
+
+	for (l = p->links; l != NULL && rv == 0; l = l->next)
+		rv = tar_extract_linkto(t, l->linkname, l->filename,
+					&(l->meta));
+
+	pextract_links_free(p);
+	return rv;
+}
+
+
+int
+tar_extract_all_parallel(TAR *t, char *prefix, int nthreads)
+{
+	struct pextract p;
+	struct pworker *w;
+	char buf[MAXPATHLEN];
+	char *filename;
+	int i, n, rv = 0, err = 0;
+
+#ifdef DEBUG
+	printf("==> tar_extract_all_parallel(TAR *t, \"%s\", %d)\n",
+	       (prefix ? prefix : "(null)"), nthreads);
+#endif
+
+	if (tar_dir_root(t, prefix) == -1)
+		return -1;
+
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 4;
+
+	memset(&p, 0, sizeof(p));
+	p.linktail = &(p.links);
+	p.maxjobs = pextract_maxjobs(nthreads);
+	p.dirs = libtar_hash_new(64, (libtar_hashfunc_t)pdir_hashfunc);
+	if (p.dirs == NULL)
+		return -1;
+	p.workers = (struct pworker *)calloc(nthreads, sizeof(struct pworker));
+	if (p.workers == NULL)
+	{
+		libtar_hash_free(p.dirs, NULL);
+		return -1;
+	}
+	pthread_mutex_init(&(p.lock), NULL);
+	pthread_cond_init(&(p.space), NULL);
+	for (n = 0; n < nthreads; n++)
+	{
+		w = &(p.workers[n]);
+		w->p = &p;
+		pthread_cond_init(&(w->cond), NULL);
+		if (pthread_create(&(w->thread), NULL, pworker_main, w) != 0)
+		{
+			pthread_cond_destroy(&(w->cond));
+			break;
+		}
+	}
+	p.nworkers = n;
+
+	/* no threads to be had, do it the old way */
+	if (n == 0)
+	{
+		pthread_cond_destroy(&(p.space));
+		pthread_mutex_destroy(&(p.lock));
+		libtar_hash_free(p.dirs, NULL);
+		free(p.workers);
+		return tar_extract_all(t, prefix);
+	}
+
+	while ((i = th_read(t)) == 0)
+	{
+		filename = th_get_pathname(t);
+		if (t->options & TAR_VERBOSE)
+			th_print_long_ls(t);
+		if (prefix != NULL)
+			snprintf(buf, sizeof(buf), "%s/%s", prefix, filename);
+		else
+			strlcpy(buf, filename, sizeof(buf));
+		w = &(p.workers[pextract_hash(buf) % p.nworkers]);
+
+		if ((t->options & TAR_NOOVERWRITE)
+		    && pextract_exists(t, &p, buf))
+		{
+			errno = EEXIST;
+			i = -1;
+			break;
+		}
+
+		/*
+		** an entry that replaces a queued hardlink has to find it
+		** on disk, as it would have without the queue
+		*/
+		if (!TH_ISLNK(t) && pextract_link_queued(&p, buf)
+		    && pextract_links(t, &p) == -1)
+		{
+			i = -1;
+			break;
+		}
+
+		if (TH_ISLNK(t))
+		{
+			i = pextract_hardlink(t, &p, buf);
+			if (i == 0)
+				i = tar_extract_remember(t, buf);
+		}
+		else if (TH_ISREG(t) && !TH_ISSPARSE(t)
+			 && !(t->options & TAR_DEDUP)
+			 && th_get_size(t) >= 0
+			 && th_get_size(t) <= PJOB_MAXSIZE)
+		{
+			i = pextract_regfile(t, &p, w, buf);
+			if (i == 0)
+				i = tar_extract_remember(t, buf);
+		}
+		else
+		{
+			/*
+			** keep anything else in order with earlier writes;
+			** TAR_DEDUP needs the files it copies from on disk
+			*/
+			i = pextract_wait_idle(&p, w);
+			if (i == 0)
+				i = tar_extract_file(t, buf);
+		}
+		if (i != 0)
+			break;
+	}
+	if (i != 1)
+	{
+		err = errno;
+		rv = -1;
+	}
+
+	/*
+	** let the workers drain their queues and exit; what was queued before
+	** a failure here is still written, as tar_extract_all() would have
+	*/
+	pthread_mutex_lock(&(p.lock));
+	p.done = 1;
+	for (n = 0; n < p.nworkers; n++)
+		pthread_cond_signal(&(p.workers[n].cond));
+	pthread_mutex_unlock(&(p.lock));
+	for (n = 0; n < p.nworkers; n++)
+	{
+		pthread_join(p.workers[n].thread, NULL);
+		pthread_cond_destroy(&(p.workers[n].cond));
+	}
+	if (rv == 0 && p.err != 0)
+	{
+		err = p.err;
+		rv = -1;
+	}
+
+	if (p.err == 0 && pextract_links(t, &p) == -1 && rv == 0)
+	{
+		err = errno;
+		rv = -1;
+	}
+
+	/* directories last, now that nothing else is written into them */
+	if (rv == 0 && tar_dir_finish(t) == -1)
+	{
+		err = errno;
+		rv = -1;
+	}
+
+	pextract_links_free(&p);
+	if (p.linknames != NULL)
+		libtar_hash_free(p.linknames, NULL);
+	libtar_hash_free(p.dirs, NULL);
+	pthread_cond_destroy(&(p.space));
+	pthread_mutex_destroy(&(p.lock));
+	free(p.workers);
+
+	if (rv != 0)
+		errno = err;
+	return rv;
+}
@@ -0,0 +1,350 @@
+/*
+**  selector.c - libtar code to pick archive entries by path
+**
+**  A selector is built once from any number of include and exclude
+**  rules and then asked about every entry.  Exact paths and prefixes
+**  share one hash table, probed once for each leading component of the
+**  entry's path, so the cost doesn't grow with the number of rules.
+**  Globs are only handed to fnmatch() once the literal text before their
+**  first wildcard and after their last one matches.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/param.h>
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+# include <string.h>
+#endif
+
+
+/* bits in struct sel_path flags */
+#define SEL_INCL_PATH		1
+#define SEL_INCL_PREFIX		2
+#define SEL_EXCL_PATH		4
+#define SEL_EXCL_PREFIX		8
+
+/* an exact path or prefix; also used as a lookup key */
+struct sel_path
+{
+	const char *path;	/* not NUL-terminated in a key */
+	size_t len;
+	int flags;
+	int found;		/* an entry matched SEL_INCL_PATH */
+};
+
+struct sel_glob
+{
+	char *pattern;
+	size_t headlen;		/* literal text before the first wildcard */
+	const char *tail;	/* literal text after the last one */
+	size_t taillen;
+	int exclude;
+};
+
+struct tar_selector
+{
+	libtar_hash_t *paths;
+	struct sel_glob *globs;
+	int nglobs;
+	int nincl_paths;	/* paths with SEL_INCL_PATH */
+	int nincl_found;	/* of those, how many were matched */
+	int nincl_other;	/* include prefixes and globs */
+};
+
+
+static unsigned int
+sel_path_hash(struct sel_path *p, unsigned int numbuckets)
+{
+	unsigned int h = 2166136261U;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < p->len; i++)
+	{
+		h ^= (unsigned char)p->path[i];
+		h *= 16777619U;
+	}
+
+	return (h % numbuckets);
+}
+
+
+static int
+sel_path_match(struct sel_path *key, struct sel_path *p)
+{
+	return (key->len == p->len && memcmp(key->path, p->path, p->len) == 0);
+}
+
+
+/* the length of path without a leading "./" or trailing slashes */
+static const char *
+sel_normalize(const char *path, size_t *len)
+{
+	size_t n;
+
+	while (path[0] == '.' && path[1] == '/')
+		for (path += 2; *path == '/'; path++)
+			;
+	for (n = strlen(path); n > 1 && path[n - 1] == '/'; n--)
+		;
+	*len = n;
+
+	return path;
+}
+
+
+static struct sel_path *
+sel_lookup(tar_selector_t *s, const char *path, size_t len)
+{
+	struct sel_path key;
+	libtar_hashptr_t hp;
+
+	key.path = path;
+	key.len = len;
+	libtar_hashptr_reset(&hp);
+	if (libtar_hash_getkey(s->paths, &hp, &key,
+			       (libtar_matchfunc_t)sel_path_match) == 0)
+		return NULL;
+
+	return (struct sel_path *)libtar_hashptr_data(&hp);
+}
+
+
+static void
+sel_path_free(struct sel_path *p)
+{
+	free((char *)p->path);
+	free(p);
+}
+
+
+tar_selector_t *
+tar_selector_new(void)
+{
+	tar_selector_t *s;
+
+	s = (tar_selector_t *)calloc(1, sizeof(tar_selector_t));
+	if (s == NULL)
+		return NULL;
+	s->paths = libtar_hash_new(64, (libtar_hashfunc_t)sel_path_hash);
+	if (s->paths == NULL)
+	{
+		free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+
+void
+tar_selector_free(tar_selector_t *s)
+{
+	int i;
+
+	libtar_hash_free(s->paths, (libtar_freefunc_t)sel_path_free);
+	for (i = 0; i < s->nglobs; i++)
+		free(s->globs[i].pattern);
+	free(s->globs);
+	free(s);
+}
+
+
+static int
+sel_add_glob(tar_selector_t *s, const char *pattern, int exclude)
+{
+	struct sel_glob *g;
+	const char *p, *last = NULL;
+	size_t len;
+
+	g = (struct sel_glob *)realloc(s->globs,
+				       (s->nglobs + 1) * sizeof(*g));
+	if (g == NULL)
+		return -1;
+	s->globs = g;
+	g = &(s->globs[s->nglobs]);
+
+	pattern = sel_normalize(pattern, &len);
+	g->pattern = strndup(pattern, len);
+	if (g->pattern == NULL)
+		return -1;
+	g->exclude = exclude;
+
+	/* find the literal head and tail */
+	g->headlen = strcspn(g->pattern, "*?[\\");
+	for (p = g->pattern; *p != '\0'; p++)
+	{
+		if (strchr("*?[]\\", *p) != NULL)
+			last = p;
+	}
+	g->tail = (last ? last + 1 : g->pattern);
+	g->taillen = strlen(g->tail);
+
+	s->nglobs++;
+	if (!exclude)
+		s->nincl_other++;
+	return 0;
+}
+
+
+int
+tar_selector_add(tar_selector_t *s, int type, const char *pattern)
+{
+	struct sel_path *p;
+	const char *path;
+	size_t len;
+	int flag, exclude = (type & TAR_SEL_EXCLUDE);
+
+	type &= ~TAR_SEL_EXCLUDE;
+	if (type == TAR_SEL_GLOB)
+	{
+		/* one without wildcards is just a path */
+		if (pattern[strcspn(pattern, "*?[\\")] != '\0')
+			return sel_add_glob(s, pattern, exclude);
+		type = TAR_SEL_PATH;
+	}
+	if (type == TAR_SEL_PATH)
+		flag = (exclude ? SEL_EXCL_PATH : SEL_INCL_PATH);
+	else if (type == TAR_SEL_PREFIX)
+		flag = (exclude ? SEL_EXCL_PREFIX : SEL_INCL_PREFIX);
+	else
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	path = sel_normalize(pattern, &len);
+	p = sel_lookup(s, path, len);
+	if (p == NULL)
+	{
+		p = (struct sel_path *)calloc(1, sizeof(struct sel_path));
+		if (p == NULL)
+			return -1;
+		p->path = strndup(path, len);
+		p->len = len;
+		if (p->path == NULL || libtar_hash_add(s->paths, p) == -1)
+		{
+			sel_path_free(p);
+			return -1;
+		}
+	}
+	if (p->flags & flag)
+		return 0;
+	p->flags |= flag;
+
+	if (flag == SEL_INCL_PATH)
+		s->nincl_paths++;
+	else if (flag == SEL_INCL_PREFIX)
+		s->nincl_other++;
+	return 0;
+}
+
+
+static int
+sel_glob_match(struct sel_glob *g, const char *path, size_t len)
+{
+	/* cheap checks first */
+	if (strncmp(path, g->pattern, g->headlen) != 0
+	    || len < g->taillen
+	    || memcmp(path + len - g->taillen, g->tail, g->taillen) != 0)
+		return 0;
+
+	return (fnmatch(g->pattern, path, FNM_PATHNAME | FNM_PERIOD) == 0);
+}
+
+
+int
+tar_selector_match(tar_selector_t *s, const char *pathname)
+{
+	struct sel_path *p;
+	const char *path;
+	size_t len, n;
+	int incl = 0, excl = 0, i;
+	char buf[MAXPATHLEN];
+
+	path = sel_normalize(pathname, &len);
+
+	/* the path itself, then each of its leading components */
+	if (s->paths->nents > 0)
+	{
+		for (n = len; n > 0; n--)
+		{
+			if (n < len && path[n] != '/')
+				continue;
+			p = sel_lookup(s, path, n);
+			if (p == NULL)
+				continue;
+			if (n == len && (p->flags & SEL_INCL_PATH))
+			{
+				incl = 1;
+				if (!p->found)
+				{
+					p->found = 1;
+					s->nincl_found++;
+				}
+			}
+			if (n == len && (p->flags & SEL_EXCL_PATH))
+				excl = 1;
+			if (p->flags & SEL_INCL_PREFIX)
+				incl = 1;
+			if (p->flags & SEL_EXCL_PREFIX)
+				excl = 1;
+		}
+	}
+	if (excl)
+		return 0;
+
+	if (s->nglobs > 0)
+	{
+		/* fnmatch() wants the normalized path NUL-terminated */
+		if (path[len] != '\0')
+		{
+			if (len >= sizeof(buf))
+				return 0;
+			memcpy(buf, path, len);
+			buf[len] = '\0';
+			path = buf;
+		}
+		for (i = 0; i < s->nglobs; i++)
+		{
+			/* an include glob can't change the outcome now */
+			if (incl && !s->globs[i].exclude)
+				continue;
+			if (sel_glob_match(&(s->globs[i]), path, len))
+			{
+				if (s->globs[i].exclude)
+					return 0;
+				incl = 1;
+			}
+		}
+	}
+
+	/* with no include rules, everything not excluded is selected */
+	if (s->nincl_paths == 0 && s->nincl_other == 0)
+		return 1;
+	return incl;
+}
+
+
+void
+tar_selector_reset(tar_selector_t *s)
+{
+	libtar_hashptr_t hp;
+
+	libtar_hashptr_reset(&hp);
+	while (libtar_hash_next(s->paths, &hp) != 0)
+		((struct sel_path *)libtar_hashptr_data(&hp))->found = 0;
+	s->nincl_found = 0;
+}
+
+
+int
+tar_selector_done(tar_selector_t *s)
+{
+	return (s->nincl_paths > 0 && s->nincl_other == 0
+		&& s->nincl_found == s->nincl_paths);
+}
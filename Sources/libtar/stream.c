@@ -0,0 +1,204 @@
+/*
+**  stream.c - libtar code to read the contents of the current entry
+**  without extracting it to a file
+**
+**  The contents are handed out as they come out of the read-ahead buffer
+**  (or the mapping): tar_extract_to_sink() passes slices of it straight
+**  to a callback, and tar_entry_read() copies them into the caller's
+**  buffer.  Blocks are consumed from the archive whole, so the part of
+**  the last one that hasn't been handed out yet is kept in the handle's
+**  cursor, and each call picks up where the previous one left off.
+*/
+
+#include <internal.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifdef STDC_HEADERS
+# include <string.h>
+#endif
+
+
+/* the run being read: the whole file unless it's sparse */
+static int
+cursor_run(TAR *t, off_t *offset, off_t *numbytes)
+{
+	struct tar_cursor *c = &(t->cursor);
+
+	if (!TH_ISSPARSE(t))
+	{
+		if (c->run > 0)
+			return 0;
+		*offset = 0;
+		*numbytes = th_get_size(t);
+		return 1;
+	}
+
+	if (c->run >= t->th_buf.nsparse)
+		return 0;
+	*offset = t->th_buf.sparse[c->run].offset;
+	*numbytes = t->th_buf.sparse[c->run].numbytes;
+	return 1;
+}
+
+
+/*
+** find up to max of the next stored bytes of the current entry, without
+** handing them out; *offset is where they belong in the file
+** returns the number of bytes, 0 once every run has been read, or -1
+** (and sets errno) on error
+*/
+static ssize_t
+cursor_peek(TAR *t, size_t max, char **ptr, off_t *offset)
+{
+	struct tar_cursor *c = &(t->cursor);
+	off_t runoff, runlen;
+	size_t len;
+	ssize_t k;
+	char *buf;
+
+	for (;;)
+	{
+		if (!cursor_run(t, &runoff, &runlen))
+			return 0;
+		if (c->rundone < runlen)
+			break;
+		c->run++;
+		c->rundone = 0;
+	}
+
+	if (c->avail == 0)
+	{
+		/* the sparse map describes more than was archived */
+		if (c->left == 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		k = tar_block_next(t, c->left, &buf);
+		if (k <= 0)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+		c->ptr = buf;
+		c->avail = ((off_t)k > c->left ? (size_t)c->left : (size_t)k);
+		c->left -= c->avail;
+	}
+
+	len = c->avail;
+	if (len > max)
+		len = max;
+	if ((off_t)len > runlen - c->rundone)
+		len = (size_t)(runlen - c->rundone);
+
+	*ptr = c->ptr;
+	*offset = runoff + c->rundone;
+	return len;
+}
+
+
+/* hand out len bytes found by cursor_peek() at offset */
+static void
+cursor_consume(TAR *t, size_t len, off_t offset)
+{
+	struct tar_cursor *c = &(t->cursor);
+
+	c->ptr += len;
+	c->avail -= len;
+	c->rundone += len;
+	c->pos = offset + len;
+}
+
+
+/* the contents of the current regfile have been consumed in full */
+void
+tar_cursor_end(TAR *t)
+{
+	t->cursor.left = 0;
+	t->cursor.avail = 0;
+	t->cursor.pos = th_get_realsize(t);
+}
+
+
+/* pass the rest of the current regfile to a callback */
+int
+tar_extract_to_sink(TAR *t, tar_sinkfunc_t func, void *arg)
+{
+	off_t offset;
+	ssize_t k;
+	char *ptr;
+	int i;
+
+	if (!TH_ISREG(t))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	while ((k = cursor_peek(t, SSIZE_MAX, &ptr, &offset)) > 0)
+	{
+		cursor_consume(t, k, offset);
+		i = (*func)(t, ptr, (size_t)k, offset, arg);
+		if (i != 0)
+			return i;
+	}
+	if (k == -1)
+		return -1;
+
+	/* a trailing hole only shows up in the file size */
+	t->cursor.pos = th_get_realsize(t);
+
+	/* leave the handle at the next header */
+	return tar_skip_regfile(t);
+}
+
+
+/* read the next count bytes of the current regfile */
+ssize_t
+tar_entry_read(TAR *t, void *buf, size_t count)
+{
+	char *dst = (char *)buf;
+	off_t offset, size;
+	size_t n = 0, len;
+	ssize_t k;
+	char *ptr;
+
+	if (!TH_ISREG(t))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = th_get_realsize(t);
+	while (n < count && t->cursor.pos < size)
+	{
+		k = cursor_peek(t, count - n, &ptr, &offset);
+		if (k == -1)
+			return -1;
+		if (k == 0)
+			offset = size;
+
+		/* holes read as zeros */
+		if (offset > t->cursor.pos)
+		{
+			len = count - n;
+			if ((off_t)len > offset - t->cursor.pos)
+				len = (size_t)(offset - t->cursor.pos);
+			memset(dst + n, 0, len);
+			n += len;
+			t->cursor.pos += len;
+			continue;
+		}
+
+		memcpy(dst + n, ptr, k);
+		cursor_consume(t, k, offset);
+		n += k;
+	}
+
+	return n;
+}
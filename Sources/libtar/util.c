@@ -20,18 +20,20 @@
 # include <string.h>
 #endif
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
+
 
-/* hashing function for pathnames */
+/* hashing function for pathnames (the whole path, not just the basename) */
 int
 path_hashfunc(char *key, int numbuckets)
 {
-	char buf[MAXPATHLEN];
-	char *p;
-
-	strcpy(buf, key);
-	p = basename(buf);
-
-	return (((unsigned int)p[0]) % numbuckets);
+	return (int)libtar_str_hashfunc(key, (unsigned int)numbuckets);
 }
 
 
@@ -51,19 +53,25 @@ ino_match(ino_t *ino1, ino_t *ino2)
 }
 
 
-/* hashing function for dev_t's */
+/*
+** hashing functions for dev_t's and ino_t's; all bits count, and the
+** table mixes them further before picking a slot
+*/
 int
 dev_hash(dev_t *dev)
 {
-	return *dev % 16;
+	uint64_t v = (uint64_t)*dev;
+
+	return (int)(v ^ (v >> 32));
 }
 
 
-/* hashing function for ino_t's */
 int
 ino_hash(ino_t *inode)
 {
-	return *inode % 256;
+	uint64_t v = (uint64_t)*inode;
+
+	return (int)(v ^ (v >> 32));
 }
 
 
@@ -112,18 +120,107 @@ mkdirhier(char *path)
 }
 
 
+/*
+** tar_block_sum() - sum the bytes of a T_BLOCKSIZE block
+**
+** The signed sum is derived from the unsigned one: flipping the top bit
+** of every byte maps a signed char c to c + 128, so
+**	ssum = sum(b ^ 0x80) - 128 * T_BLOCKSIZE
+*/
+int
+tar_block_sum(const void *block, int *usum, int *ssum)
+{
+	const unsigned char *p = (const unsigned char *)block;
+#if defined(__AVX2__)
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i flip = _mm256_set1_epi8((char)0x80);
+	__m256i u = zero, s = zero, any = zero, v;
+	__m128i u2, s2;
+	int i;
+
+	for (i = 0; i < T_BLOCKSIZE; i += 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		any = _mm256_or_si256(any, v);
+		u = _mm256_add_epi64(u, _mm256_sad_epu8(v, zero));
+		s = _mm256_add_epi64(s, _mm256_sad_epu8(_mm256_xor_si256(v, flip),
+							zero));
+	}
+	u2 = _mm_add_epi64(_mm256_castsi256_si128(u),
+			   _mm256_extracti128_si256(u, 1));
+	s2 = _mm_add_epi64(_mm256_castsi256_si128(s),
+			   _mm256_extracti128_si256(s, 1));
+	*usum = _mm_cvtsi128_si32(u2) + _mm_cvtsi128_si32(_mm_srli_si128(u2, 8));
+	*ssum = _mm_cvtsi128_si32(s2) + _mm_cvtsi128_si32(_mm_srli_si128(s2, 8))
+		- 128 * T_BLOCKSIZE;
+
+	return _mm256_testz_si256(any, any);
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i flip = _mm_set1_epi8((char)0x80);
+	__m128i u = zero, s = zero, any = zero, v;
+	int i;
+
+	for (i = 0; i < T_BLOCKSIZE; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		any = _mm_or_si128(any, v);
+		u = _mm_add_epi64(u, _mm_sad_epu8(v, zero));
+		s = _mm_add_epi64(s, _mm_sad_epu8(_mm_xor_si128(v, flip), zero));
+	}
+	*usum = _mm_cvtsi128_si32(u) + _mm_cvtsi128_si32(_mm_srli_si128(u, 8));
+	*ssum = _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8))
+		- 128 * T_BLOCKSIZE;
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) == 0xffff;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	uint16x8_t u = vdupq_n_u16(0);
+	int16x8_t s = vdupq_n_s16(0);
+	uint8x16_t any = vdupq_n_u8(0), v;
+	int i;
+
+	/* 16-bit lanes can't overflow: 32 iterations of at most 2 * 255 */
+	for (i = 0; i < T_BLOCKSIZE; i += 16)
+	{
+		v = vld1q_u8(p + i);
+		any = vorrq_u8(any, v);
+		u = vpadalq_u8(u, v);
+		s = vpadalq_s8(s, vreinterpretq_s8_u8(v));
+	}
+	*usum = (int)vaddlvq_u16(u);
+	*ssum = (int)vaddlvq_s16(s);
+
+	return vmaxvq_u8(any) == 0;
+#else
+	unsigned int u = 0, high = 0;
+	unsigned char any = 0;
+	int i;
+
+	for (i = 0; i < T_BLOCKSIZE; i++)
+	{
+		any |= p[i];
+		u += p[i];
+		high += p[i] >> 7;
+	}
+	*usum = (int)u;
+	*ssum = (int)u - 256 * (int)high;
+
+	return any == 0;
+#endif
+}
+
+
 /* calculate header checksum */
 int
 th_crc_calc(TAR *t)
 {
-	int i, sum = 0;
+	int i, usum, ssum;
 
-	for (i = 0; i < T_BLOCKSIZE; i++)
-		sum += ((unsigned char *)(&(t->th_buf)))[i];
+	tar_block_sum(&(t->th_buf), &usum, &ssum);
 	for (i = 0; i < 8; i++)
-		sum += (' ' - (unsigned char)t->th_buf.chksum[i]);
+		usum += (' ' - (unsigned char)t->th_buf.chksum[i]);
 
-	return sum;
+	return usum;
 }
 
 
@@ -131,35 +228,123 @@ th_crc_calc(TAR *t)
 int
 th_signed_crc_calc(TAR *t)
 {
-	int i, sum = 0;
+	int i, usum, ssum;
 
-	for (i = 0; i < T_BLOCKSIZE; i++)
-		sum += ((signed char *)(&(t->th_buf)))[i];
+	tar_block_sum(&(t->th_buf), &usum, &ssum);
 	for (i = 0; i < 8; i++)
-		sum += (' ' - (signed char)t->th_buf.chksum[i]);
+		ssum += (' ' - (signed char)t->th_buf.chksum[i]);
 
-	return sum;
+	return ssum;
 }
 
 
-/* string-octal to integer conversion */
+/* compare block sums against the header's checksum */
 int
-oct_to_int(char *oct)
+th_crc_match(TAR *t, int usum, int ssum)
 {
-	int i;
+	int i, crc;
 
-	sscanf(oct, "%o", &i);
+	/* the checksum field itself is summed as if it were all spaces */
+	for (i = 0; i < 8; i++)
+	{
+		usum += (' ' - (unsigned char)t->th_buf.chksum[i]);
+		ssum += (' ' - (signed char)t->th_buf.chksum[i]);
+	}
 
-	return i;
+	crc = th_get_crc(t);
+	return (crc == usum || crc == ssum);
 }
 
 
-/* integer to string-octal conversion, no NULL */
+/* compare checksums in a forgiving way */
+int
+th_crc_ok(TAR *t)
+{
+	int usum, ssum;
+
+	tar_block_sum(&(t->th_buf), &usum, &ssum);
+	return th_crc_match(t, usum, ssum);
+}
+
+
+/* numeric header field to integer conversion */
+int64_t
+oct_to_int64(const char *oct, size_t octlen)
+{
+	const unsigned char *p = (const unsigned char *)oct;
+	const unsigned char *end = p + octlen;
+	uint64_t v;
+	unsigned int d;
+
+	if (octlen == 0)
+		return 0;
+
+	/*
+	** GNU base-256: a set top bit marks a big-endian two's complement
+	** number in the rest of the field; bit 6 of the first byte is the sign
+	*/
+	if (*p & 0x80)
+	{
+		v = ((*p & 0x40) ? ~(uint64_t)0 : 0);
+		v = (v << 6) | (*p++ & 0x3f);
+		while (p < end)
+			v = (v << 8) | *p++;
+		return (int64_t)v;
+	}
+
+	while (p < end && (*p == ' ' || *p == '\0'))
+		p++;
+
+	for (v = 0; p < end; p++)
+	{
+		d = (unsigned int)*p - '0';
+		if (d > 7)
+			break;
+		v = (v << 3) | d;
+	}
+
+	return (int64_t)v;
+}
+
+
+/* integer to numeric header field conversion */
 void
-int_to_oct_nonull(int num, char *oct, size_t octlen)
+int64_to_oct(int64_t num, char *oct, size_t octlen, int nul)
 {
-	snprintf(oct, octlen, "%*lo", octlen - 1, (unsigned long)num);
-	oct[octlen - 1] = ' ';
+	size_t ndigits, i;
+	uint64_t v = (uint64_t)num;
+
+	ndigits = octlen - 1 - (nul ? 1 : 0);
+
+	if (num < 0 || (ndigits < 22 && v >> (3 * ndigits) != 0))
+	{
+		/* doesn't fit, use GNU base-256 over the whole field */
+		for (i = octlen - 1; i > 0; i--, v >>= 8)
+			oct[i] = (char)(v & 0xff);
+		oct[0] = (char)(num < 0 ? 0xff : 0x80);
+		return;
+	}
+
+	for (i = ndigits; i > 0; i--, v >>= 3)
+		oct[i - 1] = '0' + (char)(v & 7);
+	oct[ndigits] = ' ';
+	if (nul)
+		oct[ndigits + 1] = '\0';
 }
 
 
+/* string-octal to integer conversion */
+int
+oct_to_int(char *oct)
+{
+	/* the caller's string ends at its NUL, not at any field width */
+	return (int)oct_to_int64(oct, strlen(oct));
+}
+
+
+/* integer to string-octal conversion, no NULL */
+void
+int_to_oct_nonull(int64_t num, char *oct, size_t octlen)
+{
+	int64_to_oct(num, oct, octlen, 0);
+}
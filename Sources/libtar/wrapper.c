@@ -16,11 +16,17 @@
 #include <sys/param.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef STDC_HEADERS
+# include <stdlib.h>
 # include <string.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
 
 int
 tar_extract_glob(TAR *t, char *globname, char *prefix)
@@ -29,6 +35,9 @@ tar_extract_glob(TAR *t, char *globname, char *prefix)
 	char buf[MAXPATHLEN];
 	int i;
 
+	if (tar_dir_root(t, prefix) == -1)
+		return -1;
+
 	while ((i = th_read(t)) == 0)
 	{
 		filename = th_get_pathname(t);
@@ -47,8 +56,47 @@ tar_extract_glob(TAR *t, char *globname, char *prefix)
 		if (tar_extract_file(t, buf) != 0)
 			return -1;
 	}
+	if (i != 1)
+		return -1;
+
+	return tar_dir_finish(t);
+}
+
+
+int
+tar_extract_selected(TAR *t, tar_selector_t *s, char *prefix)
+{
+	char *filename;
+	char buf[MAXPATHLEN];
+	int i;
+
+	if (tar_dir_root(t, prefix) == -1)
+		return -1;
+
+	/* the selector may have been used on another archive before */
+	tar_selector_reset(s);
+	while (!tar_selector_done(s) && (i = th_read(t)) == 0)
+	{
+		filename = th_get_pathname(t);
+		if (!tar_selector_match(s, filename))
+		{
+			if (TH_ISREG(t) && tar_skip_regfile(t))
+				return -1;
+			continue;
+		}
+		if (t->options & TAR_VERBOSE)
+			th_print_long_ls(t);
+		if (prefix != NULL)
+			snprintf(buf, sizeof(buf), "%s/%s", prefix, filename);
+		else
+			strlcpy(buf, filename, sizeof(buf));
+		if (tar_extract_file(t, buf) != 0)
+			return -1;
+	}
+	if (!tar_selector_done(s) && i != 1)
+		return -1;
 
-	return (i == 1 ? 0 : -1);
+	return tar_dir_finish(t);
 }
 
 
@@ -64,6 +112,9 @@ tar_extract_all(TAR *t, char *prefix)
 	       (prefix ? prefix : "(null)"));
 #endif
 
+	if (tar_dir_root(t, prefix) == -1)
+		return -1;
+
 	while ((i = th_read(t)) == 0)
 	{
 #ifdef DEBUG
@@ -83,8 +134,216 @@ tar_extract_all(TAR *t, char *prefix)
 		if (tar_extract_file(t, buf) != 0)
 			return -1;
 	}
+	if (i != 1)
+		return -1;
+
+	return tar_dir_finish(t);
+}
+
+
+/*
+** copy path to buf as an absolute path (relative ones are taken from
+** cwd) without "." or ".." components and repeated or trailing slashes,
+** so that names extracted as "dir/./file", "./dir//file" or
+** "/cwd/dir/file" all match the same prefix
+*/
+static int
+prune_normalize(char *buf, size_t size, const char *cwd, const char *path)
+{
+	const char *part[2], *p, *end;
+	size_t len = 0, n;
+	int i;
+
+	part[0] = (*path == '/' ? "" : cwd);
+	part[1] = path;
+	for (i = 0; i < 2; i++)
+	{
+		for (p = part[i]; *p != '\0'; p = end)
+		{
+			for (; *p == '/'; p++)
+				;
+			end = p + strcspn(p, "/");
+			n = (size_t)(end - p);
+			if (n == 0 || (n == 1 && *p == '.'))
+				continue;
+			if (n == 2 && p[0] == '.' && p[1] == '.')
+			{
+				while (len > 0 && buf[--len] != '/')
+					;
+				continue;
+			}
+			if (len + n + 2 > size)
+			{
+				errno = ENAMETOOLONG;
+				return -1;
+			}
+			buf[len++] = '/';
+			memcpy(buf + len, p, n);
+			len += n;
+		}
+	}
+	if (len == 0)
+		buf[len++] = '/';
+	buf[len] = '\0';
+
+	return 0;
+}
+
+
+/* remove what's below path (open as dirfd) and isn't in keep */
+static int
+prune_dir(libtar_hash_t *keep, int dirfd, char *path, size_t len)
+{
+	libtar_hashptr_t hp;
+	struct dirent *dent;
+	struct stat s;
+	DIR *dp;
+	size_t n, sep;
+	int fd, kept, isdir, rv = 0;
+
+	dp = fdopendir(dirfd);
+	if (dp == NULL)
+	{
+		close(dirfd);
+		return -1;
+	}
+	while ((dent = readdir(dp)) != NULL)
+	{
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		n = strlen(dent->d_name);
+		if (len + n + 2 > MAXPATHLEN)
+		{
+			errno = ENAMETOOLONG;
+			rv = -1;
+			break;
+		}
+		sep = (len > 0 && path[len - 1] != '/');
+		if (sep)
+			path[len] = '/';
+		memcpy(path + len + sep, dent->d_name, n + 1);
+
+		libtar_hashptr_reset(&hp);
+		kept = libtar_hash_getkey(keep, &hp, path,
+					  (libtar_matchfunc_t)libtar_str_match);
+
+#ifdef DT_DIR
+		if (dent->d_type != DT_UNKNOWN)
+			isdir = (dent->d_type == DT_DIR);
+		else
+#endif
+		{
+			if (fstatat(dirfd, dent->d_name, &s,
+				    AT_SYMLINK_NOFOLLOW) == -1)
+			{
+				rv = -1;
+				break;
+			}
+			isdir = S_ISDIR(s.st_mode);
+		}
+
+		if (!isdir)
+		{
+			if (!kept && unlinkat(dirfd, dent->d_name, 0) == -1)
+			{
+				rv = -1;
+				break;
+			}
+			continue;
+		}
+
+		/* a directory that's gone may still hold files that aren't */
+		fd = openat(dirfd, dent->d_name,
+			    O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		if (fd == -1
+		    || prune_dir(keep, fd, path, len + sep + n) == -1)
+		{
+			rv = -1;
+			break;
+		}
+		if (!kept && unlinkat(dirfd, dent->d_name, AT_REMOVEDIR) == -1
+		    && errno != ENOTEMPTY && errno != EEXIST)
+		{
+			rv = -1;
+			break;
+		}
+	}
+	path[len] = '\0';
+	closedir(dp);
+
+	return rv;
+}
+
+
+int
+tar_extract_prune(TAR *t, char *prefix)
+{
+	libtar_hash_t *keep;
+	libtar_hashptr_t hp;
+	char cwd[MAXPATHLEN];
+	char path[MAXPATHLEN];
+	char root[MAXPATHLEN];
+	char *lnp, *name;
+	size_t rootlen;
+	int fd, under = 0, rv = -1;
+
+	if (prefix == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* names and prefix are compared in one form, whichever way given */
+	if (getcwd(cwd, sizeof(cwd)) == NULL
+	    || prune_normalize(root, sizeof(root), cwd, prefix) == -1)
+		return -1;
+	rootlen = (strcmp(root, "/") == 0 ? 0 : strlen(root));
+
+	/* the names everything was extracted as, from the hardlink table */
+	keep = libtar_hash_new(libtar_hash_nents(t->h),
+			       (libtar_hashfunc_t)libtar_str_hashfunc);
+	if (keep == NULL)
+		return -1;
+	libtar_hashptr_reset(&hp);
+	while (libtar_hash_next(t->h, &hp) != 0)
+	{
+		lnp = (char *)libtar_hashptr_data(&hp);
+		if (prune_normalize(path, sizeof(path), cwd,
+				    &lnp[strlen(lnp) + 1]) == -1)
+			goto out;
+		if (strncmp(path, root, rootlen) == 0
+		    && (path[rootlen] == '/' || path[rootlen] == '\0'))
+			under++;
+		name = strdup(path);
+		if (name == NULL)
+			goto out;
+		if (libtar_hash_add(keep, name) == -1)
+		{
+			free(name);
+			goto out;
+		}
+	}
+
+	/*
+	** if nothing was extracted below prefix, the names can't be told
+	** apart from what should go, so don't remove anything
+	*/
+	if (under == 0)
+	{
+		errno = EINVAL;
+		goto out;
+	}
+
+	fd = open(root, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		goto out;
+	rv = prune_dir(keep, fd, root, strlen(root));
 
-	return (i == 1 ? 0 : -1);
+ out:
+	libtar_hash_free(keep, (libtar_freefunc_t)free);
+	return rv;
 }
 
 
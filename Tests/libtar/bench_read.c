@@ -0,0 +1,88 @@
+/*
+**  bench_read.c - time reading an archive through libtar's read-ahead
+**  buffer
+**
+**  Lists every entry of an archive (skipping file contents) through a
+**  tartype_t that counts readfunc calls, and reports the count and the
+**  elapsed time.  Run it once with the default buffer and once with a
+**  buffer of a single block, which reads the way libtar did before the
+**  read-ahead buffer existed:
+**
+**    swift run -c release bench_read archive.tar
+**    swift run -c release bench_read archive.tar 512
+*/
+
+#include <libtar.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+
+static long nreads;
+
+
+static ssize_t
+counting_read(int fd, void *buf, size_t len)
+{
+	nreads++;
+	return read(fd, buf, len);
+}
+
+
+static tartype_t counting_type = {
+	(openfunc_t)open, close, counting_read, write, lseek
+};
+
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	TAR *t;
+	long entries = 0;
+	int i;
+
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s archive [readbuf-size]\n", argv[0]);
+		return 2;
+	}
+
+	if (tar_open(&t, argv[1], &counting_type, O_RDONLY, 0, 0) == -1)
+	{
+		perror("tar_open()");
+		return 1;
+	}
+	if (argc == 3 && tar_set_readbuf(t, (size_t)atol(argv[2])) == -1)
+	{
+		perror("tar_set_readbuf()");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((i = th_read(t)) == 0)
+	{
+		entries++;
+		if (TH_ISREG(t) && tar_skip_regfile(t) == -1)
+		{
+			perror("tar_skip_regfile()");
+			return 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (i == -1)
+	{
+		perror("th_read()");
+		return 1;
+	}
+	tar_close(t);
+
+	printf("%ld entries, %ld readfunc calls, %.3f s\n", entries, nreads,
+	       (double)(end.tv_sec - start.tv_sec)
+	       + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+**  check.c - helpers shared by the libtar behaviour checks
+*/
+
+#include "check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+
+int
+check_fail(const char *file, int line, const char *what)
+{
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+	return 1;
+}
+
+
+char *
+check_mkdtemp(const char *name)
+{
+	const char *tmp;
+	char *dir;
+	size_t len;
+
+	tmp = getenv("TMPDIR");
+	if (tmp == NULL || *tmp == '\0')
+		tmp = "/tmp";
+	len = strlen(tmp) + strlen(name) + 10;
+	dir = (char *)malloc(len);
+	if (dir == NULL)
+	{
+		perror("malloc()");
+		return NULL;
+	}
+	snprintf(dir, len, "%s/%s.XXXXXX", tmp, name);
+	if (mkdtemp(dir) == NULL)
+	{
+		perror(dir);
+		free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+
+const char *
+check_path(const char *dir, const char *name)
+{
+	static char path[MAXPATHLEN];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return path;
+}
+
+
+int
+check_write(const char *dir, const char *name, const char *data,
+	    size_t len)
+{
+	char path[MAXPATHLEN];
+	char *slash;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	for (slash = strchr(path + strlen(dir) + 1, '/'); slash != NULL;
+	     slash = strchr(slash + 1, '/'))
+	{
+		*slash = '\0';
+		if (mkdir(path, 0755) == -1 && errno != EEXIST)
+		{
+			perror(path);
+			return -1;
+		}
+		*slash = '/';
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || write(fd, data, len) != (ssize_t)len)
+	{
+		perror(path);
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+
+int
+check_exists(const char *dir, const char *name)
+{
+	struct stat s;
+
+	return (lstat(check_path(dir, name), &s) == 0);
+}
+
+
+static int
+rmtree_entry(const char *path, const struct stat *s, int flag,
+	     struct FTW *ftw)
+{
+	(void)s;
+	(void)flag;
+	(void)ftw;
+	remove(path);
+	return 0;
+}
+
+
+void
+check_rmtree(const char *path)
+{
+	nftw(path, rmtree_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+
+int
+check_archive(const char *tarfile, const char *dir, const char **names,
+	      int options)
+{
+	char path[MAXPATHLEN];
+	TAR *t;
+	int i;
+
+	if (tar_open(&t, tarfile, NULL, O_WRONLY | O_CREAT | O_TRUNC, 0644,
+		     options) == -1)
+	{
+		perror("tar_open()");
+		return -1;
+	}
+	for (i = 0; names[i] != NULL; i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		if (tar_append_file(t, path, names[i]) == -1)
+		{
+			perror(path);
+			tar_close(t);
+			return -1;
+		}
+	}
+	if (tar_append_eof(t) == -1)
+	{
+		perror("tar_append_eof()");
+		tar_close(t);
+		return -1;
+	}
+
+	return tar_close(t);
+}
@@ -0,0 +1,45 @@
+/*
+**  check.h - helpers shared by the libtar behaviour checks
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <libtar.h>
+
+#include <stddef.h>
+
+
+/* evaluates to 0, or reports the failed condition and evaluates to 1 */
+#define CHECK(cond) \
+	((cond) ? 0 : check_fail(__FILE__, __LINE__, #cond))
+
+int check_fail(const char *file, int line, const char *what);
+
+/*
+** create a scratch directory; returns its path (to be freed), or NULL
+** after reporting why not
+*/
+char *check_mkdtemp(const char *name);
+
+/* dir/name, in a static buffer that the next call overwrites */
+const char *check_path(const char *dir, const char *name);
+
+/* write len bytes of data to dir/name, creating its parent directories */
+int check_write(const char *dir, const char *name, const char *data,
+		size_t len);
+
+/* returns 1 if dir/name exists, without following a symlink */
+int check_exists(const char *dir, const char *name);
+
+/* remove path and everything below it */
+void check_rmtree(const char *path);
+
+/*
+** archive the named files of dir into tarfile, in the order given and
+** under the names given
+*/
+int check_archive(const char *tarfile, const char *dir,
+		  const char **names, int options);
+
+#endif /* ! CHECK_H */
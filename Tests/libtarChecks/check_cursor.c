@@ -0,0 +1,113 @@
+/*
+**  check_cursor.c - check that reading an entry's contents leaves the
+**  handle at the next header
+**
+**  Builds a small archive in a scratch directory, then reads its first
+**  entries with tar_extract_regfile() (plain and with TAR_DEDUP, where
+**  the second copy of a payload isn't written at all) and with
+**  tar_regfile_data().  After each one, tar_skip_regfile() and
+**  tar_entry_read() must find nothing left, and th_read() must return
+**  the next entry.
+*/
+
+#include "check.h"
+#include <libtar_checks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+
+/* the contents of the current entry are gone; the next one is expected */
+static int
+check_next(TAR *t, const char *expected)
+{
+	char buf[16];
+	int n = 0;
+
+	n += CHECK(tar_entry_read(t, buf, sizeof(buf)) == 0);
+	n += CHECK(tar_skip_regfile(t) == 0);
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(strcmp(th_get_pathname(t), expected) == 0);
+
+	return n;
+}
+
+
+static int
+check_extract(const char *dir, const char *tarfile, int options)
+{
+	char path[256];
+	TAR *t;
+	int n = 0;
+
+	if (tar_open(&t, tarfile, NULL, O_RDONLY, 0, options) == -1)
+		return CHECK(!"tar_open()");
+
+	snprintf(path, sizeof(path), "%s/out.a", dir);
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(tar_extract_regfile(t, path) == 0);
+	n += check_next(t, "a2");
+
+	snprintf(path, sizeof(path), "%s/out.a2", dir);
+	n += CHECK(tar_extract_regfile(t, path) == 0);
+	n += check_next(t, "b");
+
+	tar_close(t);
+	return n;
+}
+
+
+static int
+check_data(const char *tarfile)
+{
+	const char *data;
+	size_t size;
+	TAR *t;
+	int n = 0;
+
+	if (tar_mmap_open(&t, tarfile, 0) == -1)
+		return CHECK(!"tar_mmap_open()");
+
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(tar_regfile_data(t, &data, &size) == 0);
+	n += CHECK(size == 3000);
+	n += check_next(t, "a2");
+
+	tar_close(t);
+	return n;
+}
+
+
+int
+check_cursor(void)
+{
+	static const char *names[] = { "a", "a2", "b", NULL };
+	char tarfile[256];
+	char buf[3000];
+	char *dir;
+	int n = 0;
+
+	dir = check_mkdtemp("check_cursor");
+	if (dir == NULL)
+		return 1;
+
+	memset(buf, 'a', sizeof(buf));
+	snprintf(tarfile, sizeof(tarfile), "%s/test.tar", dir);
+	if (check_write(dir, "a", buf, sizeof(buf)) == -1
+	    || check_write(dir, "a2", buf, sizeof(buf)) == -1
+	    || check_write(dir, "b", "bbbbbbbbbb", 10) == -1
+	    || check_archive(tarfile, dir, names, TAR_GNU) == -1)
+		n += CHECK(!"building the archive");
+	else
+	{
+		n += check_extract(dir, tarfile, 0);
+		n += check_extract(dir, tarfile, TAR_DEDUP);
+		n += check_data(tarfile);
+	}
+
+	check_rmtree(dir);
+	free(dir);
+	return n;
+}
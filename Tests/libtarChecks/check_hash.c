@@ -0,0 +1,172 @@
+/*
+**  check_hash.c - check libtar's open-addressing hash table
+**
+**  Starting from a small table, adds enough keys to make it grow several
+**  times, deletes half of them again and checks that lookups skip the
+**  deleted slots, then adds and deletes many more keys one at a time:
+**  the deleted slots they leave behind must be reclaimed by rehashing
+**  at the same size rather than by doubling the table every time.
+*/
+
+#include "check.h"
+#include <libtar_checks.h>
+#include <libtar_listhash.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NKEYS	10000
+#define NCHURN	100000
+
+
+static int
+check_find(libtar_hash_t *h, const char *key, int expected)
+{
+	libtar_hashptr_t hp;
+	int found;
+
+	libtar_hashptr_reset(&hp);
+	found = libtar_hash_getkey(h, &hp, (void *)key,
+				   (libtar_matchfunc_t)libtar_str_match);
+	if (found != expected)
+	{
+		fprintf(stderr, "check_hash: \"%s\" %sfound\n", key,
+			found ? "" : "not ");
+		return 1;
+	}
+	if (found && strcmp((char *)libtar_hashptr_data(&hp), key) != 0)
+		return CHECK(!"libtar_hash_getkey() returned another key");
+
+	return 0;
+}
+
+
+/* delete key, which must be in the table */
+static int
+check_del(libtar_hash_t *h, const char *key)
+{
+	libtar_hashptr_t hp;
+	void *data;
+
+	libtar_hashptr_reset(&hp);
+	if (!libtar_hash_getkey(h, &hp, (void *)key,
+				(libtar_matchfunc_t)libtar_str_match))
+		return CHECK(!"deleting a key that isn't there");
+	data = libtar_hashptr_data(&hp);
+	if (libtar_hash_del(h, &hp) == -1)
+		return CHECK(!"libtar_hash_del()");
+	free(data);
+
+	return 0;
+}
+
+
+static int
+check_add(libtar_hash_t *h, const char *key)
+{
+	char *data;
+
+	data = strdup(key);
+	if (data == NULL || libtar_hash_add(h, data) == -1)
+	{
+		free(data);
+		return CHECK(!"libtar_hash_add()");
+	}
+
+	return 0;
+}
+
+
+int
+check_hash(void)
+{
+	libtar_hash_t *h;
+	libtar_hashptr_t hp;
+	char key[32];
+	unsigned int count;
+	int i, key_i, size, n = 0;
+
+	h = libtar_hash_new(16, NULL);
+	if (h == NULL)
+		return CHECK(!"libtar_hash_new()");
+
+	/* growth: every key is still found after the table is resized */
+	for (i = 0; i < NKEYS; i++)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		if (check_add(h, key) != 0)
+		{
+			libtar_hash_free(h, free);
+			return n + 1;
+		}
+	}
+	n += CHECK(libtar_hash_nents(h) == NKEYS);
+	n += CHECK(h->numbuckets > 16);
+	n += CHECK((h->numbuckets & (h->numbuckets - 1)) == 0);
+	n += CHECK((unsigned int)h->numbuckets * 3 >= h->nused * 4);
+	for (i = 0; i < NKEYS; i++)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_find(h, key, 1);
+	}
+	n += check_find(h, "key/-1", 0);
+
+	/* deleted slots: lookups probe past them, iteration skips them */
+	for (i = 0; i < NKEYS; i += 2)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_del(h, key);
+	}
+	n += CHECK(libtar_hash_nents(h) == NKEYS / 2);
+	for (i = 0; i < NKEYS; i++)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_find(h, key, i % 2);
+	}
+	count = 0;
+	libtar_hashptr_reset(&hp);
+	while (libtar_hash_next(h, &hp))
+	{
+		key_i = atoi((char *)libtar_hashptr_data(&hp) + 4);
+		n += CHECK(key_i % 2 == 1);
+		count++;
+	}
+	n += CHECK(count == NKEYS / 2);
+
+	/*
+	** churn: each add takes a fresh slot and each delete leaves a
+	** deleted one, so the table fills up with them; with the number
+	** of live entries constant, it must rehash rather than grow
+	*/
+	size = h->numbuckets;
+	for (i = 0; i < NCHURN && n == 0; i++)
+	{
+		snprintf(key, sizeof(key), "churn/%d", i);
+		n += check_add(h, key);
+		n += check_del(h, key);
+	}
+	n += CHECK(libtar_hash_nents(h) == NKEYS / 2);
+	n += CHECK(h->numbuckets == size);
+	for (i = 0; i < NKEYS; i++)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_find(h, key, i % 2);
+	}
+
+	/* deleted keys can be added back */
+	for (i = 0; i < NKEYS; i += 2)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_add(h, key);
+	}
+	n += CHECK(libtar_hash_nents(h) == NKEYS);
+	for (i = 0; i < NKEYS; i++)
+	{
+		snprintf(key, sizeof(key), "key/%d", i);
+		n += check_find(h, key, 1);
+	}
+
+	libtar_hash_free(h, free);
+	return n;
+}
@@ -0,0 +1,392 @@
+/*
+**  check_pax.c - check that PAX extended headers and sparse files are
+**  read as written
+**
+**  Writes an archive header by header: a global header whose values
+**  apply to every later entry until another one changes them, per-file
+**  headers that override them (a long path, a fractional mtime, the
+**  size), and the same sparse file in PAX format 1.0, PAX format 0.1
+**  and an old GNU 'S' header.  Reads it back with th_read() and
+**  tar_entry_read(), then extracts it and looks at the files.
+*/
+
+#include "check.h"
+#include <libtar_checks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define LONGPATH	"long/dddddddddddddddddddddddddddddddddddddddddddddd" \
+			"dddddddddddddddddddddddddddddddddddddddddddddddd" \
+			"dddddddddddddddddddddddddddddddddddddddddddddddd/file"
+
+/* each sparse file: "AAAAA" at 0 and "BBBBB" at 512k, 1M in all */
+#define SPARSE_SIZE	1048576
+#define SPARSE_OFFSET	524288
+#define SPARSE_DATA	"AAAAABBBBB"
+#define SPARSE_LEN	10
+
+
+/* write len bytes of data, padded with zeros to a whole block */
+static int
+put(int fd, const char *data, size_t len)
+{
+	char pad[T_BLOCKSIZE];
+	size_t rest = (T_BLOCKSIZE - len % T_BLOCKSIZE) % T_BLOCKSIZE;
+
+	memset(pad, 0, sizeof(pad));
+	if (write(fd, data, len) != (ssize_t)len
+	    || write(fd, pad, rest) != (ssize_t)rest)
+		return -1;
+
+	return 0;
+}
+
+
+/* fill in a ustar header block; fields not given are zero */
+static void
+header(char *b, const char *name, int type, size_t size, long gid)
+{
+	memset(b, 0, T_BLOCKSIZE);
+	snprintf(b, 100, "%s", name);
+	snprintf(b + 100, 8, "%07o", 0644);
+	snprintf(b + 108, 8, "%07o", 0);
+	snprintf(b + 116, 8, "%07lo", (unsigned long)gid);
+	snprintf(b + 124, 12, "%011lo", (unsigned long)size);
+	snprintf(b + 136, 12, "%011lo", 1000000000UL);
+	b[156] = (char)type;
+	memcpy(b + 257, "ustar", 6);
+	memcpy(b + 263, "00", 2);
+}
+
+
+/* set the checksum of a header block, and write it */
+static int
+put_header(int fd, char *b)
+{
+	unsigned int sum = 0;
+	int i;
+
+	memset(b + 148, ' ', 8);
+	for (i = 0; i < T_BLOCKSIZE; i++)
+		sum += (unsigned char)b[i];
+	snprintf(b + 148, 8, "%06o", sum);
+
+	return put(fd, b, T_BLOCKSIZE);
+}
+
+
+/* append a "len key=value\n" record, len counting itself, to buf */
+static void
+record(char *buf, size_t size, const char *key, const char *value)
+{
+	size_t len, prev, base = strlen(key) + strlen(value) + 3;
+
+	len = base;
+	do
+	{
+		prev = len;
+		len = base + snprintf(NULL, 0, "%zu", prev);
+	}
+	while (len != prev);
+	snprintf(buf + strlen(buf), size - strlen(buf), "%zu %s=%s\n", len,
+		 key, value);
+}
+
+
+/* write an extended ('x') or global ('g') header holding records */
+static int
+put_pax(int fd, int type, const char *records)
+{
+	char b[T_BLOCKSIZE];
+
+	header(b, "PaxHeader", type, strlen(records), 0);
+	if (put_header(fd, b) == -1)
+		return -1;
+
+	return put(fd, records, strlen(records));
+}
+
+
+/* a regular file whose contents fill whole blocks after the header */
+static int
+put_file(int fd, const char *name, size_t size, long gid, const char *data,
+	 size_t len)
+{
+	char b[T_BLOCKSIZE];
+
+	header(b, name, REGTYPE, size, gid);
+	if (put_header(fd, b) == -1)
+		return -1;
+
+	return put(fd, data, len);
+}
+
+
+static int
+write_archive(const char *tarfile)
+{
+	char pax[1024], b[T_BLOCKSIZE], map[T_BLOCKSIZE];
+	int fd, rv = -1;
+
+	fd = open(tarfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+
+	/* global owner, then a long path and a fractional mtime */
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "uid", "4242");
+	record(pax, sizeof(pax), "gid", "4343");
+	if (put_pax(fd, 'g', pax) == -1)
+		goto out;
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "path", LONGPATH);
+	record(pax, sizeof(pax), "mtime", "1700000000.25");
+	if (put_pax(fd, 'x', pax) == -1
+	    || put_file(fd, "truncated", 5, 0, "hello", 5) == -1)
+		goto out;
+
+	/* a per-file uid and size override the global uid and the header */
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "uid", "7");
+	record(pax, sizeof(pax), "size", "3");
+	if (put_pax(fd, 'x', pax) == -1
+	    || put_file(fd, "f2", 0, 0, "abc", 3) == -1)
+		goto out;
+
+	/* an empty value in a global header drops the global gid */
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "gid", "");
+	if (put_pax(fd, 'g', pax) == -1
+	    || put_file(fd, "f3", 1, 55, "x", 1) == -1)
+		goto out;
+
+	/* format 1.0: the map comes first in the data, as decimal lines */
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "GNU.sparse.major", "1");
+	record(pax, sizeof(pax), "GNU.sparse.minor", "0");
+	record(pax, sizeof(pax), "GNU.sparse.name", "sparse10");
+	record(pax, sizeof(pax), "GNU.sparse.realsize", "1048576");
+	memset(map, 0, sizeof(map));
+	snprintf(map, sizeof(map), "2\n0\n5\n%d\n5\n", SPARSE_OFFSET);
+	if (put_pax(fd, 'x', pax) == -1
+	    || put_file(fd, "GNUSparseFile.0/sparse10",
+			T_BLOCKSIZE + SPARSE_LEN, 0, map, T_BLOCKSIZE) == -1
+	    || put(fd, SPARSE_DATA, SPARSE_LEN) == -1)
+		goto out;
+
+	/* format 0.1: the map is a header value */
+	pax[0] = '\0';
+	record(pax, sizeof(pax), "GNU.sparse.size", "1048576");
+	record(pax, sizeof(pax), "GNU.sparse.numblocks", "2");
+	record(pax, sizeof(pax), "GNU.sparse.map", "0,5,524288,5");
+	record(pax, sizeof(pax), "path", "sparse01");
+	if (put_pax(fd, 'x', pax) == -1
+	    || put_file(fd, "GNUSparseFile.0/sparse01", SPARSE_LEN, 0,
+			SPARSE_DATA, SPARSE_LEN) == -1)
+		goto out;
+
+	/* old GNU: the map is in the header block itself */
+	header(b, "sparseS", GNU_SPARSE_TYPE, SPARSE_LEN, 0);
+	memcpy(b + 257, "ustar  ", 8);
+	snprintf(b + 386, 12, "%011o", 0);
+	snprintf(b + 398, 12, "%011o", 5);
+	snprintf(b + 410, 12, "%011o", SPARSE_OFFSET);
+	snprintf(b + 422, 12, "%011o", 5);
+	snprintf(b + 483, 12, "%011o", SPARSE_SIZE);
+	if (put_header(fd, b) == -1 || put(fd, SPARSE_DATA, SPARSE_LEN) == -1)
+		goto out;
+
+	/* the handle must be at this header after each sparse file */
+	if (put_file(fd, "last", 1, 0, "z", 1) == -1)
+		goto out;
+
+	memset(b, 0, sizeof(b));
+	if (put(fd, b, T_BLOCKSIZE) == -1 || put(fd, b, T_BLOCKSIZE) == -1)
+		goto out;
+	rv = 0;
+
+ out:
+	if (close(fd) == -1)
+		rv = -1;
+	return rv;
+}
+
+
+/* the contents of a sparse file, holes and all */
+static int
+check_sparse_data(const char *buf, size_t len)
+{
+	size_t i;
+
+	if (len != SPARSE_SIZE
+	    || memcmp(buf, SPARSE_DATA, 5) != 0
+	    || memcmp(buf + SPARSE_OFFSET, SPARSE_DATA + 5, 5) != 0)
+		return CHECK(!"sparse file contents");
+	for (i = 0; i < len; i++)
+	{
+		if (buf[i] != '\0' && i >= 5
+		    && (i < SPARSE_OFFSET || i >= SPARSE_OFFSET + 5))
+			return CHECK(!"data in a hole");
+	}
+
+	return 0;
+}
+
+
+/* the current entry is the sparse file name */
+static int
+check_sparse_entry(TAR *t, const char *name, char *buf)
+{
+	size_t len = 0;
+	ssize_t k;
+	int n = 0;
+
+	n += CHECK(strcmp(th_get_pathname(t), name) == 0);
+	n += CHECK(TH_ISREG(t));
+	n += CHECK(TH_ISSPARSE(t));
+	n += CHECK(t->th_buf.nsparse == 2);
+	n += CHECK(th_get_size(t) == SPARSE_LEN);
+	n += CHECK(th_get_realsize(t) == SPARSE_SIZE);
+
+	while ((k = tar_entry_read(t, buf + len, SPARSE_SIZE + 1 - len)) > 0)
+		len += k;
+	n += CHECK(k == 0);
+	n += check_sparse_data(buf, len);
+
+	return n;
+}
+
+
+static int
+check_read(const char *tarfile, char *buf)
+{
+	static const char *sparse[] = { "sparse10", "sparse01", "sparseS",
+					NULL };
+	TAR *t;
+	int i, n = 0;
+
+	if (tar_open(&t, tarfile, NULL, O_RDONLY, 0, TAR_NUMERIC_OWNER) == -1)
+		return CHECK(!"tar_open()");
+
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(strcmp(th_get_pathname(t), LONGPATH) == 0);
+	n += CHECK(th_get_mtime(t) == 1700000000);
+	n += CHECK(th_get_mtime_nsec(t) == 250000000);
+	n += CHECK(th_get_uid(t) == 4242);
+	n += CHECK(th_get_gid(t) == 4343);
+	n += CHECK(th_get_size(t) == 5);
+	n += CHECK(tar_entry_read(t, buf, 16) == 5);
+	n += CHECK(memcmp(buf, "hello", 5) == 0);
+
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(strcmp(th_get_pathname(t), "f2") == 0);
+	n += CHECK(th_get_uid(t) == 7);
+	n += CHECK(th_get_gid(t) == 4343);
+	n += CHECK(th_get_mtime_nsec(t) == 0);
+	n += CHECK(th_get_size(t) == 3);
+	n += CHECK(tar_entry_read(t, buf, 16) == 3);
+	n += CHECK(memcmp(buf, "abc", 3) == 0);
+
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(strcmp(th_get_pathname(t), "f3") == 0);
+	n += CHECK(th_get_uid(t) == 4242);
+	n += CHECK(th_get_gid(t) == 55);
+	n += CHECK(tar_skip_regfile(t) == 0);
+
+	for (i = 0; sparse[i] != NULL; i++)
+	{
+		n += CHECK(th_read(t) == 0);
+		n += check_sparse_entry(t, sparse[i], buf);
+	}
+
+	n += CHECK(th_read(t) == 0);
+	n += CHECK(strcmp(th_get_pathname(t), "last") == 0);
+	n += CHECK(tar_skip_regfile(t) == 0);
+	n += CHECK(th_read(t) == 1);
+
+	tar_close(t);
+	return n;
+}
+
+
+static int
+check_extracted(const char *out, char *buf)
+{
+	static const char *sparse[] = { "sparse10", "sparse01", "sparseS",
+					NULL };
+	struct stat s;
+	ssize_t k;
+	int i, fd, n = 0;
+
+	n += CHECK(lstat(check_path(out, LONGPATH), &s) == 0);
+	n += CHECK(s.st_size == 5);
+	n += CHECK(s.st_mtime == 1700000000);
+	n += CHECK(check_exists(out, "f2"));
+	n += CHECK(!check_exists(out, "GNUSparseFile.0"));
+
+	for (i = 0; sparse[i] != NULL; i++)
+	{
+		fd = open(check_path(out, sparse[i]), O_RDONLY);
+		if (fd == -1)
+		{
+			n += CHECK(!"opening an extracted sparse file");
+			continue;
+		}
+		k = read(fd, buf, SPARSE_SIZE + 1);
+		close(fd);
+		n += check_sparse_data(buf, (k < 0 ? 0 : (size_t)k));
+	}
+
+	return n;
+}
+
+
+int
+check_pax(void)
+{
+	char tarfile[256];
+	char out[256];
+	char *dir, *buf;
+	TAR *t;
+	int n = 0;
+
+	dir = check_mkdtemp("check_pax");
+	if (dir == NULL)
+		return 1;
+	buf = (char *)malloc(SPARSE_SIZE + 1);
+	if (buf == NULL)
+	{
+		check_rmtree(dir);
+		free(dir);
+		return CHECK(!"malloc()");
+	}
+
+	snprintf(tarfile, sizeof(tarfile), "%s/test.tar", dir);
+	snprintf(out, sizeof(out), "%s/out", dir);
+	if (write_archive(tarfile) == -1)
+		n += CHECK(!"writing the archive");
+	else
+	{
+		n += check_read(tarfile, buf);
+
+		if (tar_open(&t, tarfile, NULL, O_RDONLY, 0,
+			     TAR_NUMERIC_OWNER) == -1)
+			n += CHECK(!"tar_open()");
+		else
+		{
+			n += CHECK(tar_extract_all(t, out) == 0);
+			tar_close(t);
+			n += check_extracted(out, buf);
+		}
+	}
+
+	free(buf);
+	check_rmtree(dir);
+	free(dir);
+	return n;
+}
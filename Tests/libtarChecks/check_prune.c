@@ -0,0 +1,162 @@
+/*
+**  check_prune.c - check that tar_extract_prune() removes what an earlier
+**  extraction left behind, and nothing else
+**
+**  Extracts an archive over a directory holding stale files and prunes
+**  it, once extracting to a relative path and pruning by the absolute
+**  one and once the other way round.  The archive has no directory
+**  entries, so its directories only survive because they hold extracted
+**  files.  Pruning a directory nothing was extracted to must fail with
+**  EINVAL and leave it alone.
+*/
+
+#include "check.h"
+#include <libtar_checks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/* what an earlier version of the archive left in out */
+static const char *stale[] = {
+	"stale", "keep/old", "keep/sub/gone", "olddir/x", NULL
+};
+
+
+static int
+check_pruned(const char *dir)
+{
+	char out[256];
+	int i, n = 0;
+
+	snprintf(out, sizeof(out), "%s/out", dir);
+	n += CHECK(check_exists(out, "keep/a"));
+	n += CHECK(check_exists(out, "keep/sub/b"));
+	for (i = 0; stale[i] != NULL; i++)
+	{
+		if (!check_exists(out, stale[i]))
+			continue;
+		fprintf(stderr, "check_prune: %s/%s not removed\n", out,
+			stale[i]);
+		n++;
+	}
+	n += CHECK(!check_exists(out, "olddir"));
+
+	/* next to the prefix, not below it */
+	n += CHECK(check_exists(dir, "other/x"));
+
+	return n;
+}
+
+
+/*
+** extract tarfile to extract_to and prune prune_to, both taken from dir,
+** which is also the working directory
+*/
+static int
+check_extract(const char *dir, const char *tarfile, const char *extract_to,
+	      const char *prune_to)
+{
+	char out[256];
+	TAR *t;
+	int i, n = 0;
+
+	snprintf(out, sizeof(out), "%s/out", dir);
+	if (mkdir(out, 0755) == -1 && errno != EEXIST)
+		return CHECK(!"creating the output directory");
+	for (i = 0; stale[i] != NULL; i++)
+	{
+		if (check_write(out, stale[i], "old", 3) == -1)
+			return CHECK(!"writing the stale files");
+	}
+
+	if (tar_open(&t, tarfile, NULL, O_RDONLY, 0, 0) == -1)
+		return CHECK(!"tar_open()");
+	n += CHECK(tar_extract_all(t, (char *)extract_to) == 0);
+	n += CHECK(tar_extract_prune(t, (char *)prune_to) == 0);
+	tar_close(t);
+	n += check_pruned(dir);
+
+	return n;
+}
+
+
+/* nothing was extracted below prefix, so nothing may be removed */
+static int
+check_outside(const char *dir, const char *tarfile)
+{
+	char other[256];
+	TAR *t;
+	int n = 0;
+
+	if (tar_open(&t, tarfile, NULL, O_RDONLY, 0, 0) == -1)
+		return CHECK(!"tar_open()");
+	n += CHECK(tar_extract_all(t, "out") == 0);
+
+	snprintf(other, sizeof(other), "%s/other", dir);
+	errno = 0;
+	n += CHECK(tar_extract_prune(t, other) == -1);
+	n += CHECK(errno == EINVAL);
+	n += CHECK(check_exists(dir, "other/x"));
+
+	/* a prefix that only shares the start of a name isn't a parent */
+	errno = 0;
+	n += CHECK(tar_extract_prune(t, "ou") == -1);
+	n += CHECK(errno == EINVAL);
+	tar_close(t);
+
+	return n;
+}
+
+
+int
+check_prune(void)
+{
+	static const char *names[] = { "keep/a", "keep/sub/b", NULL };
+	char tarfile[256];
+	char src[256];
+	char out[256];
+	char *dir;
+	int cwd, n = 0;
+
+	dir = check_mkdtemp("check_prune");
+	if (dir == NULL)
+		return 1;
+	cwd = open(".", O_RDONLY | O_DIRECTORY);
+	if (cwd == -1 || chdir(dir) == -1)
+	{
+		perror(dir);
+		if (cwd != -1)
+			close(cwd);
+		check_rmtree(dir);
+		free(dir);
+		return 1;
+	}
+
+	snprintf(tarfile, sizeof(tarfile), "%s/test.tar", dir);
+	snprintf(src, sizeof(src), "%s/src", dir);
+	snprintf(out, sizeof(out), "%s/out", dir);
+	if (check_write(dir, "src/keep/a", "a", 1) == -1
+	    || check_write(dir, "src/keep/sub/b", "b", 1) == -1
+	    || check_write(dir, "other/x", "x", 1) == -1
+	    || check_archive(tarfile, src, names, 0) == -1)
+		n += CHECK(!"building the archive");
+	else
+	{
+		n += check_extract(dir, tarfile, "out", out);
+		n += check_extract(dir, tarfile, out, "./out/");
+		n += check_outside(dir, tarfile);
+	}
+
+	if (fchdir(cwd) == -1)
+		n += CHECK(!"returning to the working directory");
+	close(cwd);
+	check_rmtree(dir);
+	free(dir);
+	return n;
+}
@@ -0,0 +1,193 @@
+/*
+**  check_selector.c - check how selectors pick archive entries
+**
+**  Matches paths against a selector with prefix, exact path and glob
+**  rules, some of them exclusions, and checks when tar_selector_done()
+**  says the rest of an archive can be skipped.  Then uses one selector
+**  for two tar_extract_selected() calls in a row: the second must
+**  extract the same files as the first.
+*/
+
+#include "check.h"
+#include <libtar_checks.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+
+struct expect
+{
+	const char *path;
+	int selected;
+};
+
+
+static int
+check_rules(void)
+{
+	static const struct expect paths[] = {
+		{ "a/b", 1 },
+		{ "a/b/", 1 },
+		{ "a/bc", 0 },
+		{ "a/b/c/d", 1 },
+		{ "a/b/no", 0 },
+		{ "a/b/no/z", 0 },
+		{ "a/b/skipme", 0 },
+		{ "x/y", 1 },
+		{ "./x/y/", 1 },
+		{ "x/y/z", 0 },
+		{ "g/h.c", 1 },
+		{ "g/h/i.c", 0 },
+		{ "g/.h.c", 0 },
+		{ "z", 0 },
+		{ NULL, 0 }
+	};
+	tar_selector_t *s;
+	int i, n = 0;
+
+	s = tar_selector_new();
+	if (s == NULL)
+		return CHECK(!"tar_selector_new()");
+	if (tar_selector_add(s, TAR_SEL_PREFIX, "a/b/") == -1
+	    || tar_selector_add(s, TAR_SEL_PATH, "./x/y") == -1
+	    || tar_selector_add(s, TAR_SEL_GLOB, "g/*.c") == -1
+	    || tar_selector_add(s, TAR_SEL_GLOB | TAR_SEL_EXCLUDE,
+				"*/*/skip*") == -1
+	    || tar_selector_add(s, TAR_SEL_PREFIX | TAR_SEL_EXCLUDE,
+				"a/b/no") == -1)
+	{
+		tar_selector_free(s);
+		return CHECK(!"tar_selector_add()");
+	}
+
+	for (i = 0; paths[i].path != NULL; i++)
+	{
+		if (tar_selector_match(s, paths[i].path) == paths[i].selected)
+			continue;
+		fprintf(stderr, "check_selector: \"%s\" %sselected\n",
+			paths[i].path, paths[i].selected ? "not " : "");
+		n++;
+	}
+
+	/* a prefix or glob can always match something later on */
+	n += CHECK(tar_selector_done(s) == 0);
+	tar_selector_free(s);
+
+	return n;
+}
+
+
+static int
+check_done(void)
+{
+	tar_selector_t *s;
+	int n = 0;
+
+	s = tar_selector_new();
+	if (s == NULL)
+		return CHECK(!"tar_selector_new()");
+
+	/* a glob without wildcards is an exact path */
+	if (tar_selector_add(s, TAR_SEL_GLOB, "p") == -1
+	    || tar_selector_add(s, TAR_SEL_PATH, "q/") == -1)
+	{
+		tar_selector_free(s);
+		return CHECK(!"tar_selector_add()");
+	}
+	n += CHECK(tar_selector_match(s, "p") == 1);
+	n += CHECK(tar_selector_done(s) == 0);
+	n += CHECK(tar_selector_match(s, "q") == 1);
+	n += CHECK(tar_selector_done(s) == 1);
+
+	tar_selector_reset(s);
+	n += CHECK(tar_selector_done(s) == 0);
+	tar_selector_free(s);
+
+	/* with only exclude rules, everything else is selected */
+	s = tar_selector_new();
+	if (s == NULL)
+		return n + CHECK(!"tar_selector_new()");
+	if (tar_selector_add(s, TAR_SEL_GLOB | TAR_SEL_EXCLUDE, "*.o") == -1)
+		n += CHECK(!"tar_selector_add()");
+	else
+	{
+		n += CHECK(tar_selector_match(s, "a.o") == 0);
+		n += CHECK(tar_selector_match(s, "a.c") == 1);
+		n += CHECK(tar_selector_done(s) == 0);
+	}
+	tar_selector_free(s);
+
+	return n;
+}
+
+
+static int
+check_reuse(const char *dir, const char *tarfile)
+{
+	char out[256];
+	tar_selector_t *s;
+	TAR *t;
+	int pass, n = 0;
+
+	s = tar_selector_new();
+	if (s == NULL)
+		return CHECK(!"tar_selector_new()");
+	if (tar_selector_add(s, TAR_SEL_PATH, "a/f1") == -1
+	    || tar_selector_add(s, TAR_SEL_PATH, "a/f2") == -1)
+	{
+		tar_selector_free(s);
+		return CHECK(!"tar_selector_add()");
+	}
+
+	for (pass = 1; pass <= 2; pass++)
+	{
+		snprintf(out, sizeof(out), "%s/out%d", dir, pass);
+		if (tar_open(&t, tarfile, NULL, O_RDONLY, 0, 0) == -1)
+		{
+			n += CHECK(!"tar_open()");
+			break;
+		}
+		n += CHECK(tar_extract_selected(t, s, out) == 0);
+		n += CHECK(tar_selector_done(s) == 1);
+		tar_close(t);
+
+		n += CHECK(check_exists(out, "a/f1"));
+		n += CHECK(check_exists(out, "a/f2"));
+		n += CHECK(!check_exists(out, "b"));
+	}
+
+	tar_selector_free(s);
+	return n;
+}
+
+
+int
+check_selector(void)
+{
+	static const char *names[] = { "a/f1", "b", "a/f2", NULL };
+	char tarfile[256];
+	char *dir;
+	int n = 0;
+
+	n += check_rules();
+	n += check_done();
+
+	dir = check_mkdtemp("check_selector");
+	if (dir == NULL)
+		return n + 1;
+
+	snprintf(tarfile, sizeof(tarfile), "%s/test.tar", dir);
+	if (check_write(dir, "a/f1", "f1", 2) == -1
+	    || check_write(dir, "a/f2", "f2", 2) == -1
+	    || check_write(dir, "b", "b", 1) == -1
+	    || check_archive(tarfile, dir, names, 0) == -1)
+		n += CHECK(!"building the archive");
+	else
+		n += check_reuse(dir, tarfile);
+
+	check_rmtree(dir);
+	free(dir);
+	return n;
+}
@@ -0,0 +1,34 @@
+/*
+**  libtar_checks.h - behaviour checks for libtar, run by libtarTests
+**
+**  Each check works in a scratch directory of its own and returns the
+**  number of failed expectations, which it reports on stderr.
+*/
+
+#ifndef LIBTAR_CHECKS_H
+#define LIBTAR_CHECKS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* reading an entry's contents leaves the handle at the next header */
+int check_cursor(void);
+
+/* the hash table grows, and reuses the slots of deleted entries */
+int check_hash(void);
+
+/* selector rules, and reusing a selector for another extraction */
+int check_selector(void);
+
+/* tar_extract_prune() removes only what wasn't extracted below prefix */
+int check_prune(void);
+
+/* PAX headers and the GNU sparse formats are read as written */
+int check_pax(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! LIBTAR_CHECKS_H */
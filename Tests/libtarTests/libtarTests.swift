@@ -0,0 +1,27 @@
+import Testing
+import libtarChecks
+
+// The checks are written in C against libtar's API (Tests/libtarChecks);
+// each returns its number of failures and reports them on stderr.  Some
+// change the working directory, so they run one at a time.
+@Suite(.serialized) struct LibtarTests {
+    @Test func cursor() {
+        #expect(check_cursor() == 0)
+    }
+
+    @Test func hash() {
+        #expect(check_hash() == 0)
+    }
+
+    @Test func selector() {
+        #expect(check_selector() == 0)
+    }
+
+    @Test func prune() {
+        #expect(check_prune() == 0)
+    }
+
+    @Test func pax() {
+        #expect(check_pax() == 0)
+    }
+}